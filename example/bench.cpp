@@ -0,0 +1,228 @@
+// SPDX-License-Identifier: MIT
+//
+// Micro benchmarks for the twenty6 ringbuffer
+//
+// Copyright (C) 2025 Technische Universität Dresden
+// Christian von Elm <christian.von_elm@tu-dresden.de>
+
+#include <twenty6/copy.hpp>
+#include <twenty6/ringbuf.hpp>
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cstdint>
+#include <cstring>
+
+extern "C"
+{
+#include <unistd.h>
+}
+
+/*
+ * Amount of payload bytes moved per measurement, so that every size runs for a comparable time.
+ * Small sizes are capped at MAX_ITERATIONS, as they are dominated by per-call overhead anyway
+ */
+constexpr uint64_t BYTES_PER_RUN = 1ULL << 28;
+constexpr uint64_t MAX_ITERATIONS = 4ULL << 20;
+
+template <typename F>
+double measure_ns(uint64_t iterations, F&& fn)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        fn();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count();
+}
+
+void print_result(const std::string& name, size_t size, uint64_t iterations, double ns)
+{
+    fmt::print("{:<16} {:>8} {:>12.2f} {:>10.2f}\n", name, size, ns / iterations,
+               static_cast<double>(size) * iterations / ns);
+}
+
+/*
+ * Compares the copy implementations against plain memcpy, both on a plain buffer
+ * and through the reserve()/publish()/read()/consume() cycle of a ring buffer
+ */
+void bench_copy(size_t pages)
+{
+    const std::vector<size_t> sizes = { 8, 16, 32, 64, 128, 256, 512, 1024, 4096, 16384, 65536 };
+
+    auto rb = twenty6::Ringbuf::create_memfd_ringbuf(pages);
+
+    std::vector<std::byte> src(sizes.back());
+    std::vector<std::byte> dst(sizes.back());
+    for (size_t i = 0; i < src.size(); i++)
+    {
+        src[i] = static_cast<std::byte>(i);
+    }
+
+    fmt::print("# copy, ring buffer of {} bytes, dispatched implementation: {}\n", rb.size(),
+               twenty6::copy_impl_name(twenty6::copy_impl()));
+    fmt::print("{:<16} {:>8} {:>12} {:>10}\n", "variant", "size", "ns/op", "GB/s");
+
+    for (size_t size : sizes)
+    {
+        if (size * 2 >= rb.size())
+        {
+            break;
+        }
+        uint64_t iterations = std::min(BYTES_PER_RUN / size, MAX_ITERATIONS);
+
+        for (auto impl : { twenty6::CopyImpl::MEMCPY, twenty6::CopyImpl::SSE2,
+                           twenty6::CopyImpl::AVX2, twenty6::CopyImpl::AVX512 })
+        {
+            if (!twenty6::copy_impl_supported(impl))
+            {
+                continue;
+            }
+            double ns = measure_ns(iterations, [&]() {
+                twenty6::copy(dst.data(), src.data(), size, impl);
+                asm volatile("" : : "r"(dst.data()) : "memory");
+            });
+            print_result(twenty6::copy_impl_name(impl), size, iterations, ns);
+        }
+
+        double ns = measure_ns(iterations, [&]() {
+            memcpy(rb.reserve(size), src.data(), size);
+            rb.publish();
+            memcpy(dst.data(), rb.read(size), size);
+            rb.consume();
+        });
+        print_result("rb memcpy", size, iterations, ns);
+
+        for (bool non_temporal : { false, true })
+        {
+            ns = measure_ns(iterations, [&]() {
+                rb.write(src.data(), size, non_temporal);
+                rb.publish();
+                rb.read_into(dst.data(), size);
+                rb.consume();
+            });
+            print_result(non_temporal ? "rb write nt" : "rb write", size, iterations, ns);
+        }
+    }
+}
+
+/*
+ * Fills the ring buffer on one thread and drains it completely on another, in turns.
+ *
+ * This way, every cache line the reader touches was last written by the other core and
+ * vice versa, which is what a consumer sees when it catches up on a large backlog.
+ * Fill and drain are timed separately.
+ */
+void bench_drain_one(size_t pages, size_t msg_size, size_t read_prefetch, size_t write_prefetch)
+{
+    auto writer = twenty6::Ringbuf::create_memfd_ringbuf(pages);
+    auto reader = twenty6::Ringbuf::attach_ringbuf(writer.fd());
+
+    writer.set_write_prefetch(write_prefetch);
+    reader.set_read_prefetch(read_prefetch);
+
+    std::vector<std::byte> src(msg_size, std::byte { 1 });
+    uint64_t msgs_per_round = (writer.size() - 1) / msg_size;
+    uint64_t rounds = std::max<uint64_t>(4, BYTES_PER_RUN / (msgs_per_round * msg_size));
+
+    std::atomic<uint64_t> filled { 0 };
+    std::atomic<uint64_t> drained { 0 };
+    double drain_ns = 0;
+    uint64_t checksum = 0;
+
+    std::thread drain_thread([&]() {
+        for (uint64_t round = 1; round <= rounds; round++)
+        {
+            while (filled.load(std::memory_order_acquire) != round)
+            {
+            }
+            drain_ns += measure_ns(msgs_per_round, [&]() {
+                const auto* msg = reinterpret_cast<const uint64_t*>(reader.read(msg_size));
+                for (size_t i = 0; i < msg_size / sizeof(uint64_t); i++)
+                {
+                    checksum += msg[i];
+                }
+            });
+            reader.consume();
+            drained.store(round, std::memory_order_release);
+        }
+    });
+
+    double fill_ns = 0;
+    for (uint64_t round = 1; round <= rounds; round++)
+    {
+        fill_ns += measure_ns(msgs_per_round, [&]() {
+            writer.write(src.data(), msg_size);
+        });
+        writer.publish();
+        filled.store(round, std::memory_order_release);
+        while (drained.load(std::memory_order_acquire) != round)
+        {
+        }
+    }
+    drain_thread.join();
+
+    if (checksum != rounds * msgs_per_round * (msg_size / sizeof(uint64_t)) * 0x0101010101010101ULL)
+    {
+        throw std::runtime_error("Drained data does not match the written data");
+    }
+
+    double bytes = static_cast<double>(rounds * msgs_per_round * msg_size);
+    fmt::print("{:>12} {:>8} {:>10} {:>10} {:>10.2f} {:>10.2f}\n", writer.size(), msg_size,
+               read_prefetch, write_prefetch, bytes / fill_ns, bytes / drain_ns);
+}
+
+/*
+ * Compares fill and drain throughput with and without prefetching, for ring buffers
+ * that fit into L2, into L3, and neither
+ */
+void bench_drain()
+{
+    const std::vector<size_t> ring_sizes = { 256 * 1024, 4 * 1024 * 1024, 128 * 1024 * 1024 };
+    const std::vector<size_t> distances = { 0, 512, 2048, 8192 };
+    const size_t msg_size = 256;
+
+    fmt::print("# drain, fill and drain throughput in GB/s\n");
+    fmt::print("{:>12} {:>8} {:>10} {:>10} {:>10} {:>10}\n", "ring size", "msg size",
+               "read pf", "write pf", "fill", "drain");
+
+    for (size_t ring_size : ring_sizes)
+    {
+        for (size_t distance : distances)
+        {
+            bench_drain_one(ring_size / getpagesize(), msg_size, distance, distance);
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::string mode = argc > 1 ? argv[1] : "all";
+
+    try
+    {
+        if (mode == "all" || mode == "copy")
+        {
+            bench_copy(64);
+        }
+        if (mode == "all" || mode == "drain")
+        {
+            bench_drain();
+        }
+    }
+    catch (std::runtime_error& e)
+    {
+        fmt::print(stderr, "Benchmark failed: {}\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -1,179 +1,942 @@
 // SPDX-License-Identifier: MIT
 //
-// Simple two-threaded ringbuffer fuzzer
+// Multi-threaded ringbuffer stress test and fuzzer
 //
 // Copyright (C) 2025 Technische Universität Dresden
 // Christian von Elm <christian.von_elm@tu-dresden.de>
 
-#include <memory>
 #include <twenty6/ringbuf.hpp>
 
-#include <iostream>
-#include <stdexcept>
+#include <fmt/core.h>
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <random>
+#include <stdexcept>
+#include <string>
 #include <thread>
+#include <tuple>
+#include <vector>
 
+#include <cctype>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
 
 extern "C"
 {
+#include <sched.h>
 #include <sys/types.h>
 #include <unistd.h>
 }
 
-char* buf;
+/*
+ * Every ring buffer carries a deterministic byte stream: the byte at stream offset i is
+ * derived from (seed, i). This lets the reader check the content and position of every
+ * byte it reads, no matter how reads and writes are split up.
+ */
+
+uint64_t splitmix64(uint64_t x)
+{
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+/*
+ * Calls fn(i, byte) for the bytes [offset, offset + size) of the stream
+ */
+template <typename F>
+void for_stream(uint64_t seed, uint64_t offset, size_t size, F&& fn)
+{
+    uint64_t word = splitmix64(seed ^ (offset / 8));
+    for (size_t i = 0; i < size; i++)
+    {
+        uint64_t pos = offset + i;
+        if (pos % 8 == 0)
+        {
+            word = splitmix64(seed ^ (pos / 8));
+        }
+        fn(i, static_cast<std::byte>(word >> (pos % 8 * 8)));
+    }
+}
+
+/*
+ * Position dependent checksum, so that reordered bytes change the result
+ */
+uint64_t checksum_add(uint64_t checksum, const std::byte* data, uint64_t offset, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        uint64_t weight = ((offset + i) * 0x9E3779B97F4A7C15ULL) | 1;
+        checksum += (std::to_integer<uint64_t>(data[i]) + 1) * weight;
+    }
+    return checksum;
+}
+
+/*
+ * Distribution of message sizes, fully determined by the rng, so that runs are
+ * reproducible across standard libraries
+ */
+struct SizeDistribution
+{
+    enum class Kind
+    {
+        FIXED,
+        UNIFORM,
+        EXPONENTIAL,
+    };
+
+    Kind kind = Kind::UNIFORM;
+    uint64_t a = 0;
+    uint64_t b = 0;
+
+    static SizeDistribution parse(const std::string& spec)
+    {
+        SizeDistribution dist;
+        std::vector<std::string> parts;
+        size_t start = 0;
+        while (true)
+        {
+            size_t end = spec.find(':', start);
+            parts.push_back(spec.substr(start, end - start));
+            if (end == std::string::npos)
+            {
+                break;
+            }
+            start = end + 1;
+        }
+
+        if (parts[0] == "fixed" && parts.size() == 2)
+        {
+            dist.kind = Kind::FIXED;
+            dist.a = std::stoull(parts[1]);
+        }
+        else if (parts[0] == "uniform" && parts.size() == 3)
+        {
+            dist.kind = Kind::UNIFORM;
+            dist.a = std::stoull(parts[1]);
+            dist.b = std::stoull(parts[2]);
+            if (dist.b < dist.a)
+            {
+                throw std::runtime_error("uniform size distribution: max must be >= min");
+            }
+        }
+        else if (parts[0] == "exp" && parts.size() == 2)
+        {
+            dist.kind = Kind::EXPONENTIAL;
+            dist.a = std::stoull(parts[1]);
+        }
+        else
+        {
+            throw std::runtime_error(fmt::format("Invalid size distribution: {}", spec));
+        }
+        return dist;
+    }
+
+    uint64_t operator()(std::mt19937_64& rng) const
+    {
+        switch (kind)
+        {
+        case Kind::FIXED:
+            return a;
+        case Kind::UNIFORM:
+            return a + rng() % (b - a + 1);
+        case Kind::EXPONENTIAL:
+        {
+            double u = (rng() >> 11) * 0x1.0p-53;
+            return static_cast<uint64_t>(-std::log1p(-u) * a);
+        }
+        }
+        return 0;
+    }
+
+    std::string to_string() const
+    {
+        switch (kind)
+        {
+        case Kind::FIXED:
+            return fmt::format("fixed:{}", a);
+        case Kind::UNIFORM:
+            return fmt::format("uniform:{}:{}", a, b);
+        case Kind::EXPONENTIAL:
+            return fmt::format("exp:{}", a);
+        }
+        return "";
+    }
+};
+
+enum class Pinning
+{
+    NONE,
+    // Writer and reader on the two hardware threads of one core
+    SMT,
+    // Writer and reader on different cores
+    CORE,
+    // Writer and reader on different NUMA nodes
+    NUMA,
+};
+
+struct Config
+{
+    uint64_t seed = 0;
+    double duration = 10;
+    size_t pairs = 1;
+    size_t pages = 1;
+    size_t prefetch = 0;
+    SizeDistribution sizes;
+    Pinning pinning = Pinning::CORE;
+    bool batches = false;
+};
+
+struct Cpu
+{
+    int id;
+    int core;
+    int package;
+    int node;
+};
+
+/*
+ * count and size the writer reserve()d for one batch in batch mode
+ */
+struct Batch
+{
+    uint32_t count;
+    uint32_t size;
+};
+
+/*
+ * Shared state of one writer/reader pair.
+ *
+ * Around every publish() and consume(), the harness stores how far the buffer got before
+ * ("publishing", "consuming") and after ("published", "consumed") the call. That brackets
+ * the head and tail the ring buffer can possibly see, so the other side can check whether
+ * a failed or successful reserve()/read() was correct.
+ *
+ * These are byte offsets into the buffer, which in batch mode include the batch headers,
+ * unlike the stream offsets of the payload.
+ */
+struct Pair
+{
+    std::unique_ptr<twenty6::Ringbuf> rb;
+    uint64_t stream_seed = 0;
+    int writer_cpu = -1;
+    int reader_cpu = -1;
+
+    alignas(64) std::atomic<uint64_t> publishing { 0 };
+    std::atomic<uint64_t> published { 0 };
+    alignas(64) std::atomic<uint64_t> consuming { 0 };
+    std::atomic<uint64_t> consumed { 0 };
+    alignas(64) std::atomic<bool> done { false };
+
+    // Batch mode: the batches the writer published, in order, for the reader to check
+    std::mutex batches_lock;
+    std::deque<Batch> batches;
+
+    // Written by the writer before done is set
+    uint64_t total = 0;
+    uint64_t writer_checksum = 0;
+    uint64_t writer_ops = 0;
+    uint64_t full_hits = 0;
+
+    // Written by the reader before it exits
+    uint64_t reader_checksum = 0;
+    uint64_t reader_ops = 0;
+    uint64_t empty_hits = 0;
+};
 
 enum class RingbufReadOps : uint64_t
 {
     CONSUME = 0,
     READ = 1,
     PEEK = 2,
+    READ_INTO = 3,
 };
 
 enum class RingbufWriteOps : uint64_t
 {
     PUBLISH = 0,
-    RESERVE = 1
+    RESERVE = 1,
+    WRITE = 2,
+    WRITE_NT = 3,
 };
 
-void read_thread(int fd)
+[[noreturn]] void fail(const Config& config, size_t pair, const std::string& msg)
+{
+    fmt::print(stderr, "pair {}: {}\nReproduce with --seed {}\n", pair, msg, config.seed);
+    std::exit(1);
+}
+
+void pin_to(int cpu)
+{
+    if (cpu == -1)
+    {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) == -1)
+    {
+        fmt::print(stderr, "Could not pin thread to cpu {}: {}\n", cpu, strerror(errno));
+    }
+}
+
+void write_thread(const Config& config, Pair& pair, size_t pair_id)
 {
+    pin_to(pair.writer_cpu);
+
+    twenty6::Ringbuf& rb = *pair.rb;
+    std::mt19937_64 rng(splitmix64(config.seed ^ (pair_id * 2)));
+    std::vector<std::byte> scratch;
+    uint64_t size = rb.size();
+
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                        std::chrono::duration<double>(config.duration));
+
+    // Stream offset and buffer offset of the next reserve()
+    uint64_t reserved = 0;
+    uint64_t head = 0;
+
+    // Batch mode: the batch the next publish() completes
+    bool batch_open = false;
+    Batch batch = {};
+
+    auto publish = [&]() {
+        pair.publishing.store(head);
+        if (batch_open)
+        {
+            std::lock_guard<std::mutex> lock(pair.batches_lock);
+            pair.batches.push_back(batch);
+            batch_open = false;
+        }
+        rb.publish();
+        pair.published.store(head);
+    };
+
+    for (uint64_t ops = 1;; ops++)
+    {
+        if (ops % 1024 == 0 && std::chrono::steady_clock::now() >= deadline)
+        {
+            pair.writer_ops = ops;
+            break;
+        }
+
+        RingbufWriteOps op = static_cast<RingbufWriteOps>(rng() % 4);
+        if (op == RingbufWriteOps::PUBLISH)
+        {
+            publish();
+            continue;
+        }
+
+        uint64_t msg_size = config.sizes(rng);
+        // The first reserve() of a batch also makes room for the batch header
+        uint64_t needed = msg_size;
+        if (config.batches && !batch_open)
+        {
+            needed += sizeof(ringbuf_batch_header);
+        }
+        uint64_t consumed_before = pair.consumed.load();
+
+        std::byte* msg = nullptr;
+        bool ok;
+        if (op == RingbufWriteOps::RESERVE)
+        {
+            msg = rb.reserve(msg_size);
+            ok = msg != nullptr;
+        }
+        else
+        {
+            scratch.resize(msg_size);
+            for_stream(pair.stream_seed, reserved, msg_size,
+                       [&](size_t i, std::byte b) { scratch[i] = b; });
+            ok = rb.write(scratch.data(), msg_size, op == RingbufWriteOps::WRITE_NT);
+        }
+
+        uint64_t consuming_after = pair.consuming.load();
+
+        if (!ok)
+        {
+            // The buffer is full if there are not needed + 1 bytes between our position
+            // and the tail, as seen at any point during the call
+            if (msg_size != 0 && head + needed < consumed_before + size)
+            {
+                fail(config, pair_id,
+                     fmt::format("reserve({}) failed at buffer offset {}, but at least {} "
+                                 "bytes were consumed",
+                                 msg_size, head, consumed_before));
+            }
+            pair.full_hits++;
+            continue;
+        }
+
+        if (msg_size == 0 || head + needed >= consuming_after + size)
+        {
+            fail(config, pair_id,
+                 fmt::format("reserve({}) succeeded at buffer offset {}, but at most {} "
+                             "bytes were consumed",
+                             msg_size, head, consuming_after));
+        }
+
+        if (config.batches)
+        {
+            if (!batch_open)
+            {
+                batch_open = true;
+                batch = {};
+            }
+            batch.count++;
+            batch.size += msg_size;
+        }
+
+        if (msg != nullptr)
+        {
+            for_stream(pair.stream_seed, reserved, msg_size,
+                       [&](size_t i, std::byte b) { msg[i] = b; });
+            pair.writer_checksum = checksum_add(pair.writer_checksum, msg, reserved, msg_size);
+        }
+        else
+        {
+            pair.writer_checksum =
+                checksum_add(pair.writer_checksum, scratch.data(), reserved, msg_size);
+        }
+        reserved += msg_size;
+        head += needed;
+    }
+
+    publish();
+
+    pair.total = reserved;
+    pair.done.store(true);
+}
+
+void read_thread(const Config& config, Pair& pair, size_t pair_id)
+{
+    pin_to(pair.reader_cpu);
+
     std::unique_ptr<twenty6::Ringbuf> rb;
     try
     {
-        rb = std::make_unique<twenty6::Ringbuf>(twenty6::Ringbuf::attach_ringbuf(fd));
+        rb = std::make_unique<twenty6::Ringbuf>(twenty6::Ringbuf::attach_ringbuf(pair.rb->fd()));
+        rb->set_read_prefetch(config.prefetch);
     }
     catch (std::runtime_error& e)
     {
-        std::cerr << "Could not initialize read side of ring buffer: " << e.what() << std::endl;
-        std::exit(1);
+        fail(config, pair_id,
+             fmt::format("Could not initialize read side of ring buffer: {}", e.what()));
     }
-    int pagesz = getpagesize();
 
-    std::mt19937_64 rng(std::chrono::steady_clock::now().time_since_epoch().count());
-    std::uniform_int_distribution<int> cmd_distrib(0, 2);
-    std::uniform_int_distribution<int> msg_size_distrib(0, pagesz * 1.2);
+    std::mt19937_64 rng(splitmix64(config.seed ^ (pair_id * 2 + 1)));
+    std::vector<std::byte> scratch;
+
+    // Stream offset and buffer offset of the next read()
+    uint64_t read_pos = 0;
+    uint64_t tail = 0;
+    // Buffer offset up to which consume() releases, in batch mode the end of the last
+    // completely read batch
+    uint64_t consumable = 0;
+    bool done = false;
+
+    // Batch mode: sequence number of the next batch and bytes left in the current one
+    uint64_t expected_seq = 0;
+    uint64_t batch_remaining = 0;
 
-    uint64_t local_read_pos = 0;
+    auto consume = [&]() {
+        pair.consuming.store(consumable);
+        rb->consume();
+        pair.consumed.store(consumable);
+    };
 
     /*
-     * Randomly try to read, peek, or consume from the buffer.
-     *
-     * Compare the read values to the content in buf
+     * Randomly try to read, peek, or consume from the buffer, and check every result
+     * against the stream and the positions published by the writer.
+     * In batch mode, a read at the end of a batch starts the next one instead.
+     * Once the writer is done, drain everything that is left.
      */
-    while (1)
+    for (uint64_t ops = 1;; ops++)
     {
-        RingbufReadOps op = static_cast<RingbufReadOps>(cmd_distrib(rng));
-        uint64_t msg_size = msg_size_distrib(rng);
+        if (!done && pair.done.load())
+        {
+            done = true;
+        }
+        if (done && read_pos == pair.total)
+        {
+            consume();
+            pair.reader_ops = ops;
+            break;
+        }
 
-        switch (op)
+        RingbufReadOps op = static_cast<RingbufReadOps>(rng() % 4);
+        if (op == RingbufReadOps::CONSUME)
         {
-        case RingbufReadOps::READ:
+            consume();
+            continue;
+        }
+
+        if (config.batches && batch_remaining == 0)
         {
-            const std::byte* msg = rb->read(msg_size);
-            if (msg == nullptr)
+            uint64_t published_before = pair.published.load();
+            twenty6::BatchInfo info;
+            bool ok = rb->next_batch(info);
+            uint64_t publishing_after = pair.publishing.load();
+
+            if (!ok)
             {
-                // TODO: logic to check if the buf is really empty or really full
+                if (tail + sizeof(ringbuf_batch_header) <= published_before)
+                {
+                    fail(config, pair_id,
+                         fmt::format("next_batch() failed at buffer offset {}, but at least {} "
+                                     "bytes were published",
+                                     tail, published_before));
+                }
+                pair.empty_hits++;
                 continue;
             }
 
-            if (memcmp(msg, buf + local_read_pos, msg_size) != 0)
+            tail += sizeof(ringbuf_batch_header);
+            if (tail + info.size > publishing_after)
             {
-                std::cerr << "Message and backing buffer are not equal!\n";
-                std::exit(1);
+                fail(config, pair_id,
+                     fmt::format("next_batch() returned {} bytes at buffer offset {}, but at "
+                                 "most {} bytes were published",
+                                 info.size, tail, publishing_after));
+            }
+            if (info.seq != expected_seq || info.has_gap())
+            {
+                fail(config, pair_id,
+                     fmt::format("next_batch() returned batch {}, expected batch {}", info.seq,
+                                 expected_seq));
             }
 
-            local_read_pos = (local_read_pos + msg_size) % pagesz;
+            Batch batch;
+            {
+                std::lock_guard<std::mutex> lock(pair.batches_lock);
+                if (pair.batches.empty())
+                {
+                    fail(config, pair_id,
+                         fmt::format("next_batch() returned batch {}, which was not published",
+                                     info.seq));
+                }
+                batch = pair.batches.front();
+                pair.batches.pop_front();
+            }
+            if (info.count != batch.count || info.size != batch.size)
+            {
+                fail(config, pair_id,
+                     fmt::format("batch {} has {} messages of {} bytes, but {} messages of {} "
+                                 "bytes were reserved",
+                                 info.seq, info.count, info.size, batch.count, batch.size));
+            }
+
+            expected_seq++;
+            batch_remaining = info.size;
+            continue;
+        }
+
+        uint64_t msg_size = config.sizes(rng);
+        if (config.batches)
+        {
+            // Reads must not go beyond the current batch
+            msg_size = std::min(msg_size, batch_remaining);
+        }
+        else if (done)
+        {
+            msg_size = std::min(msg_size, pair.total - read_pos);
         }
-        break;
 
-        case RingbufReadOps::CONSUME:
-            rb->consume();
+        uint64_t published_before = pair.published.load();
 
+        // scratch.data() may be nullptr for empty reads, so track success separately
+        const std::byte* msg = nullptr;
+        bool ok;
+        switch (op)
+        {
+        case RingbufReadOps::READ:
+            msg = rb->read(msg_size);
+            ok = msg != nullptr;
             break;
         case RingbufReadOps::PEEK:
+            msg = rb->peek(msg_size);
+            ok = msg != nullptr;
+            break;
+        default:
+            scratch.resize(msg_size);
+            ok = rb->read_into(scratch.data(), msg_size);
+            msg = scratch.data();
+            break;
+        }
+
+        uint64_t publishing_after = pair.publishing.load();
+
+        if (!ok)
         {
-            const std::byte* msg = rb->peek(msg_size);
-            if (msg == nullptr)
+            if (tail + msg_size <= published_before)
             {
-                continue;
+                fail(config, pair_id,
+                     fmt::format("read({}) failed at buffer offset {}, but at least {} "
+                                 "bytes were published",
+                                 msg_size, tail, published_before));
+            }
+            pair.empty_hits++;
+            continue;
+        }
+
+        if (tail + msg_size > publishing_after)
+        {
+            fail(config, pair_id,
+                 fmt::format("read({}) succeeded at buffer offset {}, but at most {} "
+                             "bytes were published",
+                             msg_size, tail, publishing_after));
+        }
+
+        for_stream(pair.stream_seed, read_pos, msg_size, [&](size_t i, std::byte b) {
+            if (msg[i] != b)
+            {
+                fail(config, pair_id,
+                     fmt::format("byte at stream offset {} is {:#x}, expected {:#x}",
+                                 read_pos + i, std::to_integer<int>(msg[i]),
+                                 std::to_integer<int>(b)));
             }
+        });
+
+        if (op != RingbufReadOps::PEEK)
+        {
+            pair.reader_checksum = checksum_add(pair.reader_checksum, msg, read_pos, msg_size);
+            read_pos += msg_size;
+            tail += msg_size;
 
-            if (memcmp(msg, buf + local_read_pos, msg_size) != 0)
+            if (!config.batches)
             {
-                std::cerr << "Message and backing buffer are not equal!\n";
-                std::exit(1);
+                consumable = tail;
+            }
+            else
+            {
+                batch_remaining -= msg_size;
+                if (batch_remaining == 0)
+                {
+                    consumable = tail;
+                }
             }
         }
-        break;
+    }
+
+    if (!pair.batches.empty())
+    {
+        fail(config, pair_id,
+             fmt::format("{} published batches were never read", pair.batches.size()));
+    }
+}
+
+int read_int_file(const std::filesystem::path& path)
+{
+    std::ifstream file(path);
+    int value = -1;
+    file >> value;
+    return value;
+}
+
+/*
+ * Reads the topology of the cpus this process may run on from sysfs
+ */
+std::vector<Cpu> read_topology()
+{
+    std::vector<Cpu> cpus;
+
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1)
+    {
+        return cpus;
+    }
+
+    for (int id = 0; id < CPU_SETSIZE; id++)
+    {
+        if (!CPU_ISSET(id, &allowed))
+        {
+            continue;
         }
+
+        std::filesystem::path dir = fmt::format("/sys/devices/system/cpu/cpu{}", id);
+        Cpu cpu = { id, read_int_file(dir / "topology" / "core_id"),
+                    read_int_file(dir / "topology" / "physical_package_id"), 0 };
+
+        std::error_code ec;
+        for (auto& entry : std::filesystem::directory_iterator(dir, ec))
+        {
+            std::string name = entry.path().filename();
+            if (name.rfind("node", 0) == 0 && name.size() > 4 &&
+                std::all_of(name.begin() + 4, name.end(), ::isdigit))
+            {
+                cpu.node = std::stoi(name.substr(4));
+            }
+        }
+        cpus.push_back(cpu);
     }
+    return cpus;
 }
 
-int main(void)
+/*
+ * Assigns writer and reader cpus to all pairs according to the pinning strategy.
+ *
+ * Returns false if the machine does not have the topology the strategy needs.
+ */
+bool assign_cpus(Pinning pinning, std::vector<Pair>& pairs)
 {
-    int pagesz = getpagesize();
+    if (pinning == Pinning::NONE)
+    {
+        return true;
+    }
 
-    std::mt19937_64 rng(std::chrono::steady_clock::now().time_since_epoch().count());
+    std::vector<Cpu> cpus = read_topology();
 
-    /*
-     * buf is our "static ringbuffer" from which we read the content we write and to which
-     * we compare the read value to.
-     */
-    buf = reinterpret_cast<char*>(malloc(pagesz * 2));
+    // All hardware threads of a core, cores sorted by node
+    std::map<std::tuple<int, int, int>, std::vector<int>> cores;
+    for (auto& cpu : cpus)
+    {
+        cores[{ cpu.node, cpu.package, cpu.core }].push_back(cpu.id);
+    }
 
-    assert(pagesz % sizeof(uint64_t) == 0);
-    for (uint64_t i = 0; i < pagesz / sizeof(uint64_t); i++)
+    std::vector<std::pair<int, int>> assignment;
+    switch (pinning)
     {
-        reinterpret_cast<uint64_t*>(buf)[i] = rng();
+    case Pinning::SMT:
+        for (auto& core : cores)
+        {
+            if (core.second.size() >= 2)
+            {
+                assignment.emplace_back(core.second[0], core.second[1]);
+            }
+        }
+        break;
+    case Pinning::CORE:
+    {
+        std::vector<int> firsts;
+        for (auto& core : cores)
+        {
+            firsts.push_back(core.second[0]);
+        }
+        for (size_t i = 0; i + 1 < firsts.size(); i += 2)
+        {
+            assignment.emplace_back(firsts[i], firsts[i + 1]);
+        }
+    }
+    break;
+    case Pinning::NUMA:
+    {
+        std::map<int, std::vector<int>> nodes;
+        for (auto& core : cores)
+        {
+            nodes[std::get<0>(core.first)].push_back(core.second[0]);
+        }
+        if (nodes.size() < 2)
+        {
+            break;
+        }
+        auto& first = nodes.begin()->second;
+        auto& second = std::next(nodes.begin())->second;
+        for (size_t i = 0; i < std::min(first.size(), second.size()); i++)
+        {
+            assignment.emplace_back(first[i], second[i]);
+        }
+    }
+    break;
+    case Pinning::NONE:
+        break;
     }
-    /*
-     * Use the same "alloc twice" trick as used for the ringbuffer itself, so that
-     * we do not have to think about wrap-around
-     */
-    memcpy(buf + pagesz, buf, pagesz);
 
-    std::unique_ptr<twenty6::Ringbuf> rb;
-    try
+    if (assignment.empty())
     {
-        rb = std::make_unique<twenty6::Ringbuf>(twenty6::Ringbuf::create_memfd_ringbuf(1));
+        return false;
     }
-    catch (std::runtime_error& e)
+
+    // With more pairs than cpu pairs, pairs share cpus
+    for (size_t i = 0; i < pairs.size(); i++)
     {
-        std::cerr << "Could not create ringbuffer: " << e.what() << std::endl;
+        pairs[i].writer_cpu = assignment[i % assignment.size()].first;
+        pairs[i].reader_cpu = assignment[i % assignment.size()].second;
     }
+    return true;
+}
 
-    /*
-     * Start a separate thread for reading
-     */
-    std::thread read(read_thread, rb->fd());
-    uint64_t local_write_pos = 0;
+void usage(const char* name)
+{
+    fmt::print(stderr,
+               "Usage: {} [options]\n"
+               "  --seed N          seed for the run, random by default\n"
+               "  --duration SECS   how long the writers run, default 10\n"
+               "  --pairs N         number of writer/reader thread pairs, default 1\n"
+               "  --pages N         ring buffer size in pages, default 1\n"
+               "  --sizes DIST      message sizes, fixed:N, uniform:MIN:MAX or exp:MEAN,\n"
+               "                    default uniform:0:<1.2 * page size>\n"
+               "  --prefetch N      read and write prefetch distance, default 0\n"
+               "  --pin STRATEGY    none, smt, core or numa, default core\n"
+               "  --batches         create the ring buffers in batch mode and check the\n"
+               "                    sequence numbers, counts and sizes of all batches\n",
+               name);
+}
+
+Config parse_args(int argc, char** argv)
+{
+    Config config;
+    config.seed = std::random_device()();
+    config.sizes = SizeDistribution::parse(fmt::format("uniform:0:{}", getpagesize() * 6 / 5));
 
-    std::uniform_int_distribution<int> cmd_distrib(0, 1);
-    std::uniform_int_distribution<int> msg_size_distrib(0, pagesz * 1.2);
-    while (1)
+    for (int i = 1; i < argc; i++)
     {
-        uint64_t input = msg_size_distrib(rng);
-        RingbufWriteOps command = static_cast<RingbufWriteOps>(cmd_distrib(rng));
-        switch (command)
+        std::string arg = argv[i];
+        if (arg == "--help")
         {
-        case RingbufWriteOps::PUBLISH:
-            rb->publish();
-            break;
-        case RingbufWriteOps::RESERVE:
+            usage(argv[0]);
+            std::exit(0);
+        }
+        if (arg == "--batches")
+        {
+            config.batches = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            usage(argv[0]);
+            std::exit(1);
+        }
+        std::string value = argv[++i];
+
+        if (arg == "--seed")
+        {
+            config.seed = std::stoull(value);
+        }
+        else if (arg == "--duration")
+        {
+            config.duration = std::stod(value);
+        }
+        else if (arg == "--pairs")
+        {
+            config.pairs = std::stoull(value);
+        }
+        else if (arg == "--pages")
+        {
+            config.pages = std::stoull(value);
+        }
+        else if (arg == "--sizes")
+        {
+            config.sizes = SizeDistribution::parse(value);
+        }
+        else if (arg == "--prefetch")
+        {
+            config.prefetch = std::stoull(value);
+        }
+        else if (arg == "--pin")
         {
-            std::byte* msg = rb->reserve(input);
-            if (msg == nullptr)
+            const std::map<std::string, Pinning> strategies = { { "none", Pinning::NONE },
+                                                                 { "smt", Pinning::SMT },
+                                                                 { "core", Pinning::CORE },
+                                                                 { "numa", Pinning::NUMA } };
+            auto it = strategies.find(value);
+            if (it == strategies.end())
             {
-                continue;
+                usage(argv[0]);
+                std::exit(1);
             }
-            memcpy(msg, buf + local_write_pos, input);
-            local_write_pos = (local_write_pos + input) % pagesz;
+            config.pinning = it->second;
         }
-        break;
+        else
+        {
+            usage(argv[0]);
+            std::exit(1);
+        }
+    }
+    return config;
+}
+
+int main(int argc, char** argv)
+{
+    Config config;
+    try
+    {
+        config = parse_args(argc, argv);
+    }
+    catch (std::exception& e)
+    {
+        fmt::print(stderr, "Invalid arguments: {}\n", e.what());
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<Pair> pairs(config.pairs);
+    for (size_t i = 0; i < pairs.size(); i++)
+    {
+        try
+        {
+            pairs[i].rb = std::make_unique<twenty6::Ringbuf>(
+                twenty6::Ringbuf::create_memfd_ringbuf(
+                    config.pages, config.batches ? RINGBUF_FLAG_BATCHES : 0));
+            pairs[i].rb->set_write_prefetch(config.prefetch);
+        }
+        catch (std::runtime_error& e)
+        {
+            fmt::print(stderr, "Could not create ringbuffer: {}\n", e.what());
+            return 1;
         }
+        pairs[i].stream_seed = splitmix64(config.seed + i);
     }
+
+    if (!assign_cpus(config.pinning, pairs))
+    {
+        fmt::print(stderr, "Warning: this machine does not support the requested pinning, "
+                           "threads are not pinned\n");
+    }
+
+    fmt::print("seed {}, {} pairs, {} bytes ring buffers{}, sizes {}, prefetch {}, {} s\n",
+               config.seed, config.pairs, pairs[0].rb->size(),
+               config.batches ? " in batch mode" : "", config.sizes.to_string(), config.prefetch,
+               config.duration);
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < pairs.size(); i++)
+    {
+        threads.emplace_back(read_thread, std::cref(config), std::ref(pairs[i]), i);
+        threads.emplace_back(write_thread, std::cref(config), std::ref(pairs[i]), i);
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    fmt::print("{:>5} {:>7} {:>7} {:>14} {:>10} {:>12} {:>12} {:>10} {:>10}\n", "pair", "writer",
+               "reader", "bytes", "MB/s", "writer ops", "reader ops", "full", "empty");
+
+    uint64_t total_bytes = 0;
+    for (size_t i = 0; i < pairs.size(); i++)
+    {
+        Pair& pair = pairs[i];
+        if (pair.writer_checksum != pair.reader_checksum)
+        {
+            fail(config, i,
+                 fmt::format("checksum of written data {:#x} does not match read data {:#x}",
+                             pair.writer_checksum, pair.reader_checksum));
+        }
+        fmt::print("{:>5} {:>7} {:>7} {:>14} {:>10.1f} {:>12} {:>12} {:>10} {:>10}\n", i,
+                   pair.writer_cpu, pair.reader_cpu, pair.total, pair.total / seconds / 1e6,
+                   pair.writer_ops, pair.reader_ops, pair.full_hits, pair.empty_hits);
+        total_bytes += pair.total;
+    }
+    fmt::print("total: {} bytes in {:.2f} s, {:.1f} MB/s, all checksums match\n", total_bytes,
+               seconds, total_bytes / seconds / 1e6);
+
+    return 0;
 }
@@ -0,0 +1,419 @@
+// SPDX-License-Identifier: MIT
+//
+// C++20 coroutine interface and single-threaded event loop for twenty6 ringbuffers
+//
+// Copyright (C) 2025 Technische Universität Dresden
+// Christian von Elm <christian.von_elm@tu-dresden.de>
+
+#pragma once
+
+#if !defined(__cpp_impl_coroutine)
+#error "twenty6/async.hpp requires C++20 coroutines, the core ringbuf.hpp works with C++17"
+#endif
+
+#include <twenty6/ringbuf.hpp>
+
+#include <fmt/core.h>
+
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+extern "C"
+{
+#include <sys/epoll.h>
+#include <unistd.h>
+}
+
+namespace twenty6
+{
+
+/*
+ * A coroutine that is run by an EventLoop. Tasks start when they are spawn()ed
+ * on the loop and are destroyed by the loop when they finish.
+ */
+class Task
+{
+public:
+    struct promise_type
+    {
+        Task get_return_object()
+        {
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        std::suspend_always final_suspend() noexcept
+        {
+            return {};
+        }
+
+        void return_void()
+        {
+        }
+
+        void unhandled_exception()
+        {
+            exception = std::current_exception();
+        }
+
+        std::exception_ptr exception;
+    };
+
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    Task(Task&& other) : handle_(std::exchange(other.handle_, nullptr))
+    {
+    }
+
+    Task& operator=(Task&& other)
+    {
+        if (handle_)
+        {
+            handle_.destroy();
+        }
+        handle_ = std::exchange(other.handle_, nullptr);
+        return *this;
+    }
+
+    Task(Task&) = delete;
+    Task& operator=(Task& other) = delete;
+
+    ~Task()
+    {
+        if (handle_)
+        {
+            handle_.destroy();
+        }
+    }
+
+    handle_type release()
+    {
+        return std::exchange(handle_, nullptr);
+    }
+
+private:
+    explicit Task(handle_type handle) : handle_(handle)
+    {
+    }
+
+    handle_type handle_;
+};
+
+namespace detail
+{
+
+/*
+ * A Task parked on an eventfd. Every time the eventfd fires, try_complete() is called,
+ * and the Task is resumed once it returns true.
+ */
+class Waiter
+{
+public:
+    virtual bool try_complete() = 0;
+
+    Task::handle_type handle;
+
+protected:
+    ~Waiter() = default;
+};
+} // namespace detail
+
+/*
+ * Single-threaded executor for Tasks.
+ *
+ * Tasks waiting for a ring buffer are parked on its notification eventfd using epoll,
+ * so a single loop can serve any number of ring buffers without busy polling.
+ */
+class EventLoop
+{
+public:
+    EventLoop()
+    {
+        epfd_ = epoll_create1(EPOLL_CLOEXEC);
+        if (epfd_ == -1)
+        {
+            throw std::runtime_error(
+                fmt::format("Can not create epoll instance for event loop: {}", strerror(errno)));
+        }
+    }
+
+    EventLoop(EventLoop&) = delete;
+    EventLoop& operator=(EventLoop& other) = delete;
+
+    ~EventLoop()
+    {
+        for (auto handle : ready_)
+        {
+            handle.destroy();
+        }
+        for (auto& parked : parked_)
+        {
+            parked.second->handle.destroy();
+        }
+        close(epfd_);
+    }
+
+    /*
+     * Schedules task to be started by run()
+     */
+    void spawn(Task task)
+    {
+        ready_.push_back(task.release());
+        live_tasks_++;
+    }
+
+    /*
+     * Runs until all spawned Tasks have finished.
+     *
+     * If a Task throws, the exception is rethrown from run(). The other Tasks stay
+     * scheduled and continue on the next call to run().
+     */
+    void run()
+    {
+        epoll_event events[64];
+
+        while (live_tasks_ > 0)
+        {
+            while (!ready_.empty())
+            {
+                Task::handle_type handle = ready_.front();
+                ready_.pop_front();
+
+                handle.resume();
+                if (handle.done())
+                {
+                    std::exception_ptr exception = handle.promise().exception;
+                    handle.destroy();
+                    live_tasks_--;
+                    if (exception)
+                    {
+                        std::rethrow_exception(exception);
+                    }
+                }
+            }
+
+            if (live_tasks_ == 0)
+            {
+                break;
+            }
+
+            int nevents = epoll_wait(epfd_, events, 64, -1);
+            if (nevents == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                throw std::runtime_error(
+                    fmt::format("Waiting for ring buffer events failed: {}", strerror(errno)));
+            }
+
+            for (int i = 0; i < nevents; i++)
+            {
+                wake(events[i].data.fd);
+            }
+        }
+    }
+
+    /*
+     * Parks the Task of waiter until fd fires and waiter->try_complete() succeeds
+     */
+    void park(int fd, detail::Waiter* waiter)
+    {
+        if (fd == -1)
+        {
+            throw std::runtime_error(
+                "Can not wait on a ring buffer without notifications, see create_notifications()");
+        }
+        if (!parked_.emplace(fd, waiter).second)
+        {
+            throw std::runtime_error("Only one Task can wait on a ring buffer endpoint at a time");
+        }
+
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) == -1)
+        {
+            parked_.erase(fd);
+            throw std::runtime_error(
+                fmt::format("Can not add ring buffer eventfd to event loop: {}", strerror(errno)));
+        }
+    }
+
+private:
+    void wake(int fd)
+    {
+        uint64_t count;
+        // Resets the eventfd. Fails with EAGAIN if it was already reset, which is fine
+        [[maybe_unused]] ssize_t res = read(fd, &count, sizeof(count));
+
+        auto it = parked_.find(fd);
+        if (it == parked_.end() || !it->second->try_complete())
+        {
+            return;
+        }
+
+        epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr);
+        ready_.push_back(it->second->handle);
+        parked_.erase(it);
+    }
+
+    int epfd_ = -1;
+    size_t live_tasks_ = 0;
+    std::deque<Task::handle_type> ready_;
+    std::unordered_map<int, detail::Waiter*> parked_;
+};
+
+/*
+ * Awaitable returned by async_read()
+ */
+class ReadAwaiter : private detail::Waiter
+{
+public:
+    ReadAwaiter(EventLoop& loop, Ringbuf& rb, size_t size) : loop_(loop), rb_(rb), size_(size)
+    {
+    }
+
+    bool await_ready()
+    {
+        result_ = rb_.read(size_);
+        return result_ != nullptr;
+    }
+
+    bool await_suspend(Task::handle_type h)
+    {
+        handle = h;
+        if (try_complete())
+        {
+            return false;
+        }
+        loop_.park(rb_.data_fd(), this);
+        return true;
+    }
+
+    const std::byte* await_resume()
+    {
+        return result_;
+    }
+
+private:
+    bool try_complete() override
+    {
+        rb_.prepare_read_wait();
+        result_ = rb_.read(size_);
+        if (result_ == nullptr)
+        {
+            return false;
+        }
+        rb_.cancel_read_wait();
+        return true;
+    }
+
+    EventLoop& loop_;
+    Ringbuf& rb_;
+    size_t size_;
+    const std::byte* result_ = nullptr;
+};
+
+/*
+ * Awaitable returned by async_reserve()
+ */
+class ReserveAwaiter : private detail::Waiter
+{
+public:
+    ReserveAwaiter(EventLoop& loop, Ringbuf& rb, size_t size) : loop_(loop), rb_(rb), size_(size)
+    {
+    }
+
+    bool await_ready()
+    {
+        result_ = rb_.reserve(size_);
+        return result_ != nullptr;
+    }
+
+    bool await_suspend(Task::handle_type h)
+    {
+        handle = h;
+        if (try_complete())
+        {
+            return false;
+        }
+        loop_.park(rb_.space_fd(), this);
+        return true;
+    }
+
+    std::byte* await_resume()
+    {
+        return result_;
+    }
+
+private:
+    bool try_complete() override
+    {
+        rb_.prepare_write_wait();
+        result_ = rb_.reserve(size_);
+        if (result_ == nullptr)
+        {
+            return false;
+        }
+        rb_.cancel_write_wait();
+        return true;
+    }
+
+    EventLoop& loop_;
+    Ringbuf& rb_;
+    size_t size_;
+    std::byte* result_ = nullptr;
+};
+
+/*
+ * Reads size bytes from rb, suspending the calling Task until they are available.
+ *
+ * rb must have notifications set up, see Ringbuf::create_notifications().
+ *
+ * Errors:
+ *  - size is not smaller than the ring buffer, throws std::runtime_error, as the buffer
+ *    never holds more than its size minus one bytes
+ */
+inline ReadAwaiter async_read(EventLoop& loop, Ringbuf& rb, size_t size)
+{
+    if (size >= rb.size())
+    {
+        throw std::runtime_error(
+            "Can only read less than the size of the ring buffer, it never fills up completely!");
+    }
+    return ReadAwaiter(loop, rb, size);
+}
+
+/*
+ * Reserves size bytes on rb, suspending the calling Task until there is enough free space.
+ *
+ * rb must have notifications set up, see Ringbuf::create_notifications().
+ *
+ * Errors:
+ *  - size is zero or not smaller than the ring buffer, throws std::runtime_error
+ */
+inline ReserveAwaiter async_reserve(EventLoop& loop, Ringbuf& rb, size_t size)
+{
+    if (size == 0 || size >= rb.size())
+    {
+        throw std::runtime_error(
+            "Can only reserve between one byte and the size of the ring buffer minus one!");
+    }
+    return ReserveAwaiter(loop, rb, size);
+}
+} // namespace twenty6
@@ -0,0 +1,382 @@
+// SPDX-License-Identifier: MIT
+//
+// Vectorized copy routines with runtime CPU dispatch
+//
+// Copyright (C) 2025 Technische Universität Dresden
+// Christian von Elm <christian.von_elm@tu-dresden.de>
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TWENTY6_X86 1
+#include <immintrin.h>
+#endif
+
+namespace twenty6
+{
+
+enum class CopyImpl
+{
+    MEMCPY,
+    SSE2,
+    AVX2,
+    AVX512,
+};
+
+inline const char* copy_impl_name(CopyImpl impl)
+{
+    switch (impl)
+    {
+    case CopyImpl::MEMCPY:
+        return "memcpy";
+    case CopyImpl::SSE2:
+        return "sse2";
+    case CopyImpl::AVX2:
+        return "avx2";
+    case CopyImpl::AVX512:
+        return "avx512";
+    }
+    return "unknown";
+}
+
+namespace detail
+{
+
+/*
+ * Below this size, non-temporal copies are not worth the fence and alignment prologue
+ */
+constexpr size_t NON_TEMPORAL_MIN = 512;
+
+/*
+ * From this size on, libc memcpy (rep movsb on most CPUs) beats our vector loops
+ */
+constexpr size_t LARGE_COPY_MIN = 8192;
+
+typedef void (*copy_fn)(void*, const void*, size_t, bool);
+
+/*
+ * Copies less than 16 bytes using two (possibly overlapping) fixed-size moves
+ */
+inline void copy_small(std::byte* dst, const std::byte* src, size_t size)
+{
+    if (size >= 8)
+    {
+        uint64_t a, b;
+        memcpy(&a, src, 8);
+        memcpy(&b, src + size - 8, 8);
+        memcpy(dst, &a, 8);
+        memcpy(dst + size - 8, &b, 8);
+    }
+    else if (size >= 4)
+    {
+        uint32_t a, b;
+        memcpy(&a, src, 4);
+        memcpy(&b, src + size - 4, 4);
+        memcpy(dst, &a, 4);
+        memcpy(dst + size - 4, &b, 4);
+    }
+    else if (size > 0)
+    {
+        std::byte first = src[0];
+        std::byte mid = src[size / 2];
+        std::byte last = src[size - 1];
+        dst[0] = first;
+        dst[size / 2] = mid;
+        dst[size - 1] = last;
+    }
+}
+
+inline void copy_memcpy(void* dst, const void* src, size_t size, bool)
+{
+    memcpy(dst, src, size);
+}
+
+#ifdef TWENTY6_X86
+
+/*
+ * All vector copies follow the same scheme:
+ *  - sizes up to two vectors are done with two overlapping unaligned moves
+ *  - larger sizes copy full vectors in a loop and finish with one unaligned
+ *    move that ends exactly at dst + size
+ *  - non-temporal copies store the first vector unaligned, then stream aligned
+ *    vectors, fence and store the last vector unaligned. The overlapping parts
+ *    are written twice with the same data, so their order does not matter.
+ */
+
+__attribute__((target("sse2"))) inline void copy_sse2(void* dst_v, const void* src_v,
+                                                      size_t size, bool non_temporal)
+{
+    auto* dst = static_cast<std::byte*>(dst_v);
+    auto* src = static_cast<const std::byte*>(src_v);
+
+    if (size < 16)
+    {
+        copy_small(dst, src, size);
+        return;
+    }
+
+    __m128i last = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + size - 16));
+    if (size <= 32)
+    {
+        __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), first);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + size - 16), last);
+        return;
+    }
+
+    size_t pos = 0;
+    if (non_temporal && size >= NON_TEMPORAL_MIN)
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst),
+                         _mm_loadu_si128(reinterpret_cast<const __m128i*>(src)));
+        pos = 16 - (reinterpret_cast<uintptr_t>(dst) & 15);
+        for (; pos + 16 <= size; pos += 16)
+        {
+            _mm_stream_si128(reinterpret_cast<__m128i*>(dst + pos),
+                             _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + pos)));
+        }
+        _mm_sfence();
+    }
+    else
+    {
+        for (; pos + 64 <= size; pos += 64)
+        {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + pos));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + pos + 16));
+            __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + pos + 32));
+            __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + pos + 48));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + pos), a);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + pos + 16), b);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + pos + 32), c);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + pos + 48), d);
+        }
+        for (; pos + 16 <= size; pos += 16)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + pos),
+                             _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + pos)));
+        }
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + size - 16), last);
+}
+
+__attribute__((target("avx2"))) inline void copy_avx2(void* dst_v, const void* src_v, size_t size,
+                                                      bool non_temporal)
+{
+    auto* dst = static_cast<std::byte*>(dst_v);
+    auto* src = static_cast<const std::byte*>(src_v);
+
+    if (size < 32)
+    {
+        copy_sse2(dst, src, size, false);
+        return;
+    }
+
+    __m256i last = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + size - 32));
+    if (size <= 64)
+    {
+        __m256i first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), first);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + size - 32), last);
+        return;
+    }
+
+    size_t pos = 0;
+    if (non_temporal && size >= NON_TEMPORAL_MIN)
+    {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst),
+                            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src)));
+        pos = 32 - (reinterpret_cast<uintptr_t>(dst) & 31);
+        for (; pos + 32 <= size; pos += 32)
+        {
+            _mm256_stream_si256(reinterpret_cast<__m256i*>(dst + pos),
+                                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + pos)));
+        }
+        _mm_sfence();
+    }
+    else
+    {
+        for (; pos + 128 <= size; pos += 128)
+        {
+            __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + pos));
+            __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + pos + 32));
+            __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + pos + 64));
+            __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + pos + 96));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + pos), a);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + pos + 32), b);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + pos + 64), c);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + pos + 96), d);
+        }
+        for (; pos + 32 <= size; pos += 32)
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + pos),
+                                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + pos)));
+        }
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + size - 32), last);
+}
+
+__attribute__((target("avx512f"))) inline void copy_avx512(void* dst_v, const void* src_v,
+                                                           size_t size, bool non_temporal)
+{
+    auto* dst = static_cast<std::byte*>(dst_v);
+    auto* src = static_cast<const std::byte*>(src_v);
+
+    if (size < 64)
+    {
+        copy_avx2(dst, src, size, false);
+        return;
+    }
+
+    __m512i last = _mm512_loadu_si512(src + size - 64);
+    if (size <= 128)
+    {
+        __m512i first = _mm512_loadu_si512(src);
+        _mm512_storeu_si512(dst, first);
+        _mm512_storeu_si512(dst + size - 64, last);
+        return;
+    }
+
+    size_t pos = 0;
+    if (non_temporal && size >= NON_TEMPORAL_MIN)
+    {
+        _mm512_storeu_si512(dst, _mm512_loadu_si512(src));
+        pos = 64 - (reinterpret_cast<uintptr_t>(dst) & 63);
+        for (; pos + 64 <= size; pos += 64)
+        {
+            _mm512_stream_si512(reinterpret_cast<__m512i*>(dst + pos),
+                                _mm512_loadu_si512(src + pos));
+        }
+        _mm_sfence();
+    }
+    else
+    {
+        for (; pos + 256 <= size; pos += 256)
+        {
+            __m512i a = _mm512_loadu_si512(src + pos);
+            __m512i b = _mm512_loadu_si512(src + pos + 64);
+            __m512i c = _mm512_loadu_si512(src + pos + 128);
+            __m512i d = _mm512_loadu_si512(src + pos + 192);
+            _mm512_storeu_si512(dst + pos, a);
+            _mm512_storeu_si512(dst + pos + 64, b);
+            _mm512_storeu_si512(dst + pos + 128, c);
+            _mm512_storeu_si512(dst + pos + 192, d);
+        }
+        for (; pos + 64 <= size; pos += 64)
+        {
+            _mm512_storeu_si512(dst + pos, _mm512_loadu_si512(src + pos));
+        }
+    }
+    _mm512_storeu_si512(dst + size - 64, last);
+}
+
+#endif // TWENTY6_X86
+
+/*
+ * Returns the widest copy implementation the running CPU supports
+ */
+inline CopyImpl detect_copy_impl()
+{
+#ifdef TWENTY6_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        return CopyImpl::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return CopyImpl::AVX2;
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        return CopyImpl::SSE2;
+    }
+#endif
+    return CopyImpl::MEMCPY;
+}
+
+inline copy_fn get_copy_fn(CopyImpl impl)
+{
+    switch (impl)
+    {
+#ifdef TWENTY6_X86
+    case CopyImpl::SSE2:
+        return &copy_sse2;
+    case CopyImpl::AVX2:
+        return &copy_avx2;
+    case CopyImpl::AVX512:
+        return &copy_avx512;
+#endif
+    default:
+        return &copy_memcpy;
+    }
+}
+
+/*
+ * Chooses the implementation used by default. AVX-512 is only picked if AVX2 is
+ * missing, as the 512 bit moves were slower than AVX2 for the payload sizes we
+ * care about in the copy benchmark (example/bench.cpp)
+ */
+inline CopyImpl select_copy_impl()
+{
+    CopyImpl best = detect_copy_impl();
+    if (best == CopyImpl::AVX512)
+    {
+        return CopyImpl::AVX2;
+    }
+    return best;
+}
+
+inline copy_fn active_copy_fn()
+{
+    static const copy_fn fn = get_copy_fn(select_copy_impl());
+    return fn;
+}
+} // namespace detail
+
+/*
+ * Returns the copy implementation selected for the running CPU
+ */
+inline CopyImpl copy_impl()
+{
+    static const CopyImpl impl = detail::select_copy_impl();
+    return impl;
+}
+
+/*
+ * Returns true if impl can be used on the running CPU
+ */
+inline bool copy_impl_supported(CopyImpl impl)
+{
+    return impl <= detail::detect_copy_impl();
+}
+
+/*
+ * Copies size bytes from src to dst using the given implementation.
+ *
+ * If non_temporal is set, large copies bypass the cache on the destination side.
+ * impl must be supported by the running CPU, see copy_impl_supported()
+ */
+inline void copy(void* dst, const void* src, size_t size, CopyImpl impl, bool non_temporal = false)
+{
+    detail::get_copy_fn(impl)(dst, src, size, non_temporal);
+}
+
+/*
+ * Copies size bytes from src to dst, using the best implementation for the running CPU.
+ *
+ * If non_temporal is set, large copies bypass the cache on the destination side.
+ */
+inline void copy(void* dst, const void* src, size_t size, bool non_temporal = false)
+{
+    if (size >= detail::LARGE_COPY_MIN && !non_temporal)
+    {
+        memcpy(dst, src, size);
+        return;
+    }
+    detail::active_copy_fn()(dst, src, size, non_temporal);
+}
+} // namespace twenty6
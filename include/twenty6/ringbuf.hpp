@@ -8,6 +8,7 @@
 #pragma once
 
 #include <stdexcept>
+#include <twenty6/copy.hpp>
 #include <twenty6/types.hpp>
 
 #include <fmt/core.h>
@@ -21,9 +22,15 @@
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
+#include <ctime>
+#include <fstream>
+#include <string>
 extern "C"
 {
+#include <signal.h>
+#include <sys/eventfd.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
 }
@@ -33,10 +40,46 @@ namespace twenty6
 
 typedef void (*watermark_cb_fn)(void*);
 
+constexpr size_t CACHE_LINE_SIZE = 64;
+
+/*
+ * State of the other side of a ring buffer, see Ringbuf::peer_state()
+ */
+enum class PeerState
+{
+    // No process has claimed the other side
+    NONE,
+    ALIVE,
+    // The process is alive, but did not send a heartbeat within the timeout
+    STALE,
+    DEAD,
+};
+
+/*
+ * Describes a batch in batch mode, see Ringbuf::next_batch()
+ */
+struct BatchInfo
+{
+    uint64_t seq;
+    // The sequence number that was expected. If it differs from seq, batches were
+    // lost or reordered
+    uint64_t expected_seq;
+    uint32_t count;
+    uint32_t size;
+
+    bool has_gap() const
+    {
+        return seq != expected_seq;
+    }
+};
+
 class Ringbuf
 {
 public:
-    static Ringbuf create_memfd_ringbuf(size_t pages)
+    /*
+     * flags is a combination of RINGBUF_FLAG_*
+     */
+    static Ringbuf create_memfd_ringbuf(size_t pages, uint64_t flags = 0)
     {
         int fd = memfd_create("", 0);
         if (fd == -1)
@@ -50,81 +93,291 @@ public:
                                                  pages, strerror(errno)));
         }
 
-        auto rb = Ringbuf::attach_ringbuf(fd);
+        auto rb = Ringbuf::map_ringbuf(fd);
 
         rb.owns_fd_ = true;
 
         rb.hdr_->size = pages * getpagesize();
-        rb.hdr_->version = 1;
+        rb.hdr_->version = RINGBUF_VERSION;
         rb.hdr_->head = 0;
         rb.hdr_->tail = 0;
+        rb.hdr_->reader_waiting = 0;
+        rb.hdr_->writer_waiting = 0;
+        rb.hdr_->flags = flags;
+        rb.hdr_->head_seq = 0;
+        rb.hdr_->tail_seq = 0;
+        rb.hdr_->writer_owner = 0;
+        rb.hdr_->reader_owner = 0;
+        rb.hdr_->writer_heartbeat = 0;
+        rb.hdr_->reader_heartbeat = 0;
+
+        if ((flags & RINGBUF_FLAG_BATCHES) && rb.hdr_->size > UINT32_MAX)
+        {
+            throw std::runtime_error("Ring buffers in batch mode must be smaller than 4 GiB!");
+        }
+        rb.batches_ = flags & RINGBUF_FLAG_BATCHES;
 
         return rb;
     }
 
+    /*
+     * Errors:
+     *  - the ring buffer was created with a different header layout, that is
+     *    ringbuf_header::version is not RINGBUF_VERSION, throws std::runtime_error
+     */
     static Ringbuf attach_ringbuf(int fd)
     {
+        auto rb = Ringbuf::map_ringbuf(fd);
 
-        off_t filesize = lseek(fd, 0, SEEK_END);
+        uint64_t version = rb.hdr_->version;
+        if (version != RINGBUF_VERSION)
+        {
+            // The destructor takes the size from the header, which can not be trusted here
+            munmap(rb.hdr_, (lseek(fd, 0, SEEK_END) - getpagesize()) * 2 + getpagesize());
+            rb.hdr_ = nullptr;
+            throw std::runtime_error(fmt::format(
+                "Unsupported ring buffer version {}, expected version {}", version,
+                RINGBUF_VERSION));
+        }
 
-        if (filesize == -1)
+        // Pick up where the previous endpoint left off, if any
+        rb.batches_ = rb.hdr_->flags & RINGBUF_FLAG_BATCHES;
+        rb.sync_writer();
+        rb.sync_reader();
+
+        return rb;
+    }
+
+    int fd()
+    {
+        return fd_;
+    }
+
+    uint64_t size()
+    {
+        return hdr_->size;
+    }
+
+    /*
+     * Creates the eventfds used to signal new data to the reader and new free space
+     * to the writer. The other endpoint has to attach_notifications() to them.
+     */
+    void create_notifications()
+    {
+        int data_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (data_fd == -1)
         {
             throw std::runtime_error(
-                fmt::format("Could not get size of underlying file: {},", strerror(errno)));
+                fmt::format("Can not create data eventfd for Ringbuffer: {}", strerror(errno)));
         }
-
-        if (lseek(fd, 0, SEEK_CUR) == -1)
+        int space_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (space_fd == -1)
         {
+            close(data_fd);
             throw std::runtime_error(
-                fmt::format("Could not rewind underlying file: {},", strerror(errno)));
+                fmt::format("Can not create space eventfd for Ringbuffer: {}", strerror(errno)));
         }
 
-        if (filesize % getpagesize() != 0)
+        attach_notifications(data_fd, space_fd);
+        owns_notify_fds_ = true;
+    }
+
+    /*
+     * Uses the given eventfds, created by the other endpoint with create_notifications()
+     */
+    void attach_notifications(int data_fd, int space_fd)
+    {
+        close_notifications();
+        data_fd_ = data_fd;
+        space_fd_ = space_fd;
+    }
+
+    /*
+     * The eventfd that becomes readable after publish() was called while the reader waited
+     */
+    int data_fd()
+    {
+        return data_fd_;
+    }
+
+    /*
+     * The eventfd that becomes readable after consume() was called while the writer waited
+     */
+    int space_fd()
+    {
+        return space_fd_;
+    }
+
+    /*
+     * Announces that the reader is about to block on data_fd(). The reader has to
+     * retry read() after calling this and before blocking, otherwise it may miss a wakeup.
+     */
+    void prepare_read_wait()
+    {
+        hdr_->reader_waiting.store(1);
+    }
+
+    /*
+     * Announces that the writer is about to block on space_fd(). The writer has to
+     * retry reserve() after calling this and before blocking, otherwise it may miss a wakeup.
+     */
+    void prepare_write_wait()
+    {
+        hdr_->writer_waiting.store(1);
+    }
+
+    /*
+     * Withdraws prepare_read_wait() after the retried read() succeeded, so that the
+     * writer does not signal data_fd() needlessly
+     */
+    void cancel_read_wait()
+    {
+        hdr_->reader_waiting.store(0, std::memory_order_relaxed);
+    }
+
+    /*
+     * Withdraws prepare_write_wait() after the retried reserve() succeeded, so that the
+     * reader does not signal space_fd() needlessly
+     */
+    void cancel_write_wait()
+    {
+        hdr_->writer_waiting.store(0, std::memory_order_relaxed);
+    }
+
+    /*
+     * Claims the writer side of the ring buffer for this process.
+     *
+     * If the writer side is owned by a process that no longer exists, it is taken over,
+     * continuing at the last published position and, in batch mode, with the sequence
+     * number after the last published batch. The claim is released when this Ringbuf is
+     * destroyed, or with release().
+     *
+     * Errors:
+     *  - The writer side is owned by a live process, throws std::runtime_error
+     */
+    void claim_writer()
+    {
+        claim(hdr_->writer_owner, hdr_->writer_heartbeat, "writer");
+        role_ = Role::WRITER;
+        sync_writer();
+        if (batches_)
         {
-            throw std::runtime_error("The file size must be a multiple of the page size!");
+            recover_next_seq();
         }
+    }
 
-        if (filesize == getpagesize())
+    /*
+     * Claims the reader side of the ring buffer for this process.
+     *
+     * If the reader side is owned by a process that no longer exists, it is taken over,
+     * continuing at the last consumed position. The claim is released when this
+     * Ringbuf is destroyed, or with release().
+     *
+     * Errors:
+     *  - The reader side is owned by a live process, throws std::runtime_error
+     */
+    void claim_reader()
+    {
+        claim(hdr_->reader_owner, hdr_->reader_heartbeat, "reader");
+        role_ = Role::READER;
+        sync_reader();
+    }
+
+    /*
+     * Gives up the side claimed with claim_writer() or claim_reader()
+     */
+    void release()
+    {
+        if (role_ == Role::NONE)
         {
-            throw std::runtime_error(
-                ("The data portion of the ring buffer must be at least one page big!"));
+            return;
         }
+        uint64_t self = owner_id(getpid());
+        own_slot().compare_exchange_strong(self, 0);
+        role_ = Role::NONE;
+    }
 
-        Ringbuf rb;
-        rb.fd_ = fd;
-
-        uint64_t data_size = filesize - getpagesize();
-        void* first_mapping =
-            mmap(nullptr, data_size * 2 + getpagesize(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-        if (first_mapping == MAP_FAILED)
+    /*
+     * Records that the claimed side is making progress, see peer_state()
+     */
+    void heartbeat()
+    {
+        if (role_ == Role::NONE)
         {
-            throw std::runtime_error(
-                fmt::format("Could not create ringbuffer mapping! {}\n", strerror(errno)));
+            throw std::runtime_error("Claim a side of the ring buffer before sending heartbeats!");
         }
+        (role_ == Role::WRITER ? hdr_->writer_heartbeat : hdr_->reader_heartbeat)
+            .store(monotonic_ns());
+    }
 
-        void* second_mapping =
-            mmap(reinterpret_cast<std::byte*>(first_mapping) + getpagesize() + data_size, data_size,
-                 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, getpagesize());
+    /*
+     * Checks the process on the other side of the ring buffer.
+     *
+     * If timeout_ns is not zero, a live peer whose last heartbeat is older than
+     * timeout_ns is reported as STALE.
+     */
+    PeerState peer_state(uint64_t timeout_ns = 0)
+    {
+        if (role_ == Role::NONE)
+        {
+            throw std::runtime_error("Claim a side of the ring buffer before checking the peer!");
+        }
 
-        if (second_mapping == MAP_FAILED)
+        uint64_t owner = peer_slot().load();
+        if (owner == 0)
         {
-            throw std::runtime_error(
-                fmt::format("Could not create ringbuffer mapping! {}\n", strerror(errno)));
+            return PeerState::NONE;
+        }
+        if (!owner_alive(owner))
+        {
+            return PeerState::DEAD;
         }
-        rb.hdr_ = reinterpret_cast<struct ringbuf_header*>(first_mapping);
-        rb.data_ = reinterpret_cast<std::byte*>(rb.hdr_) + getpagesize();
 
-        return rb;
+        uint64_t last = (role_ == Role::WRITER ? hdr_->reader_heartbeat : hdr_->writer_heartbeat)
+                            .load();
+        if (timeout_ns != 0 && monotonic_ns() - last > timeout_ns)
+        {
+            return PeerState::STALE;
+        }
+        return PeerState::ALIVE;
     }
 
-    int fd()
+    /*
+     * Opens a pidfd for the process on the other side of the ring buffer. It becomes
+     * readable when that process exits, so it can be added to poll()/epoll to detect
+     * a dead peer without polling peer_state(). The caller has to close it.
+     *
+     * Returns:
+     *  - the pidfd, or -1 if there is no live peer or pidfds are not supported
+     */
+    int open_peer_pidfd()
     {
-        return fd_;
-    }
+        if (role_ == Role::NONE)
+        {
+            throw std::runtime_error("Claim a side of the ring buffer before checking the peer!");
+        }
 
-    uint64_t size()
-    {
-        return hdr_->size;
+        uint64_t owner = peer_slot().load();
+        if (owner == 0)
+        {
+            return -1;
+        }
+#ifdef SYS_pidfd_open
+        int pidfd = syscall(SYS_pidfd_open, static_cast<pid_t>(owner & 0xffffffff), 0);
+        if (pidfd == -1)
+        {
+            return -1;
+        }
+        // The pid may have been reused between reading the owner and opening the pidfd
+        if (!owner_alive(owner))
+        {
+            close(pidfd);
+            return -1;
+        }
+        return pidfd;
+#else
+        return -1;
+#endif
     }
 
     /*
@@ -145,6 +398,35 @@ public:
         watermark_payload_ = payload;
     }
 
+    /*
+     * Enables software prefetching on the read side. Every read() prefetches the
+     * data up to distance bytes ahead of the read position, so that draining a large
+     * backlog does not miss the cache on every new line.
+     * A distance of 0 disables prefetching.
+     */
+    void set_read_prefetch(size_t distance)
+    {
+        if (distance > hdr_->size)
+        {
+            throw std::runtime_error("The prefetch distance must not exceed the ring buffer size!");
+        }
+        read_prefetch_ = distance;
+    }
+
+    /*
+     * Enables software prefetching on the write side. Every reserve() prefetches the
+     * memory up to distance bytes ahead of the write position for writing.
+     * A distance of 0 disables prefetching.
+     */
+    void set_write_prefetch(size_t distance)
+    {
+        if (distance > hdr_->size)
+        {
+            throw std::runtime_error("The prefetch distance must not exceed the ring buffer size!");
+        }
+        write_prefetch_ = distance;
+    }
+
     void print()
     {
         enum class PARTS
@@ -238,40 +520,102 @@ public:
             return nullptr;
         }
 
+        // In batch mode, the first reserve() of a batch also makes room for the batch header
+        size_t needed = size;
+        if (batches_ && !batch_open_)
+        {
+            needed += sizeof(ringbuf_batch_header);
+        }
+
         uint64_t tail = hdr_->tail.load();
 
         if (local_head_ >= tail)
         {
-            if (local_head_ + size >= tail + hdr_->size)
+            if (local_head_ + needed >= tail + hdr_->size)
             {
                 return nullptr;
             }
         }
         else
         {
-            if (local_head_ + size >= tail)
+            if (local_head_ + needed >= tail)
             {
                 return nullptr;
             }
         }
 
-        uint64_t new_head = (local_head_ + size) % hdr_->size;
+        if (batches_)
+        {
+            if (!batch_open_)
+            {
+                batch_open_ = true;
+                batch_start_ = local_head_;
+                batch_count_ = 0;
+                batch_size_ = 0;
+            }
+            batch_count_++;
+            batch_size_ += size;
+        }
+
+        uint64_t new_head = (local_head_ + needed) % hdr_->size;
+
+        std::byte* res = data_ + local_head_ + (needed - size);
 
-        std::byte* res = data_ + local_head_;
+        if (write_prefetch_ != 0)
+        {
+            prefetch_ahead(local_head_, needed, write_prefetch_, true);
+        }
 
         local_head_ = new_head;
 
         return res;
     }
 
+    /*
+     * reserves size bytes on the ring buffer and copies size bytes from src into them.
+     *
+     * If non_temporal is set, large payloads are written around the cache. Use this for
+     * data the writing side will not touch again.
+     *
+     * Returns:
+     *  - true on success, false if no space is left in the buffer.
+     */
+    bool write(const void* src, size_t size, bool non_temporal = false)
+    {
+        std::byte* dst = reserve(size);
+        if (dst == nullptr)
+        {
+            return false;
+        }
+        twenty6::copy(dst, src, size, non_temporal);
+        return true;
+    }
+
     /*
      * Make all the data reserve()d since the last call of publish() available
+     *
+     * In batch mode, the data is published as one batch with the next sequence number
      */
 
     bool publish()
     {
+        if (batch_open_)
+        {
+            ringbuf_batch_header batch = { next_seq_, batch_count_, batch_size_ };
+            memcpy(data_ + batch_start_, &batch, sizeof(batch));
+            next_seq_++;
+            batch_open_ = false;
+        }
+
         uint64_t tail = hdr_->tail.load();
         hdr_->head.store(local_head_);
+        // Only a writer taking over reads head_seq, and it does not rely on it being
+        // up to date, see recover_next_seq()
+        if (batches_)
+        {
+            hdr_->head_seq.store(next_seq_, std::memory_order_release);
+        }
+        notify(hdr_->reader_waiting, data_fd_);
 
         if (watermark_ != 0)
         {
@@ -292,23 +636,11 @@ public:
      */
     const std::byte* peek(size_t size)
     {
-        uint64_t head = hdr_->head.load();
-
-        if (local_tail_ <= head)
-        {
-            if (local_tail_ + size > head)
-            {
-                return nullptr;
-            }
-        }
-        else /* tail > head */
+        if (batches_ && size > batch_remaining_)
         {
-            if (local_tail_ + size > head + hdr_->size)
-            {
-                return nullptr;
-            }
+            throw std::runtime_error("In batch mode, reads must not go beyond the current batch!");
         }
-        return data_ + local_tail_;
+        return peek_raw(size);
     }
 
     /*
@@ -324,18 +656,133 @@ public:
         {
             return nullptr;
         }
+        if (read_prefetch_ != 0)
+        {
+            prefetch_ahead(local_tail_, size, read_prefetch_, false);
+        }
         local_tail_ = (local_tail_ + size) % hdr_->size;
+
+        if (batches_)
+        {
+            batch_remaining_ -= size;
+            if (batch_remaining_ == 0)
+            {
+                batch_end_tail_ = local_tail_;
+                batch_end_seq_ = expected_seq_;
+            }
+        }
         return ptr;
     }
 
+    /*
+     * Batch mode: starts reading the next batch, whose messages can then be read with
+     * read() and peek(). Batches before the one given to resume_from() are skipped.
+     *
+     * Errors:
+     *  - There is no batch available, returns false
+     *  - The current batch was not read completely, throws std::runtime_error
+     */
+    bool next_batch(BatchInfo& info)
+    {
+        if (!batches_)
+        {
+            throw std::runtime_error("next_batch() is only available in batch mode!");
+        }
+        if (batch_remaining_ != 0)
+        {
+            throw std::runtime_error("The current batch has not been read completely!");
+        }
+
+        while (true)
+        {
+            const std::byte* ptr = peek_raw(sizeof(ringbuf_batch_header));
+            if (ptr == nullptr)
+            {
+                return false;
+            }
+
+            ringbuf_batch_header batch;
+            memcpy(&batch, ptr, sizeof(batch));
+            local_tail_ = (local_tail_ + sizeof(batch)) % hdr_->size;
+
+            info = { batch.seq, expected_seq_, batch.count, batch.size };
+            expected_seq_ = batch.seq + 1;
+
+            // Batches are published as a whole, so all of it is there if the header is
+            if (batch.seq < resume_seq_)
+            {
+                local_tail_ = (local_tail_ + batch.size) % hdr_->size;
+                batch_end_tail_ = local_tail_;
+                batch_end_seq_ = expected_seq_;
+                continue;
+            }
+
+            batch_remaining_ = batch.size;
+            if (batch_remaining_ == 0)
+            {
+                batch_end_tail_ = local_tail_;
+                batch_end_seq_ = expected_seq_;
+            }
+            return true;
+        }
+    }
+
+    /*
+     * Batch mode: skip all batches with a sequence number smaller than seq, for example
+     * the ones a restarted reader already processed before
+     */
+    void resume_from(uint64_t seq)
+    {
+        resume_seq_ = seq;
+    }
+
+    /*
+     * Batch mode: sets the sequence number of the next published batch, for example to
+     * continue the numbering of a previous writer
+     */
+    void set_next_seq(uint64_t seq)
+    {
+        next_seq_ = seq;
+        hdr_->head_seq.store(seq);
+    }
+
+    /*
+     * Copies size bytes from the current head of the ring buffer to dst, consuming them.
+     *
+     * Errors:
+     *  - There are not size bytes to read from the buffer, returns false and leaves dst untouched
+     */
+    bool read_into(void* dst, size_t size)
+    {
+        const std::byte* src = read(size);
+        if (src == nullptr)
+        {
+            return false;
+        }
+        twenty6::copy(dst, src, size);
+        return true;
+    }
+
     /*
      * Consumes the reads since the last call to consume(). After consume is called,
      * they can be overwritten with new data
+     *
+     * In batch mode, only completely read batches are consumed, so that a reader attaching
+     * later starts at a batch boundary
      */
 
     bool consume()
     {
-        hdr_->tail.store(local_tail_);
+        if (batches_)
+        {
+            hdr_->tail_seq.store(batch_end_seq_);
+            hdr_->tail.store(batch_end_tail_);
+        }
+        else
+        {
+            hdr_->tail.store(local_tail_);
+        }
+        notify(hdr_->writer_waiting, space_fd_);
         return true;
     }
 
@@ -343,6 +790,7 @@ public:
     {
         if (hdr_ != nullptr)
         {
+            release();
             munmap(hdr_, getpagesize() + hdr_->size * 2);
         }
 
@@ -350,6 +798,8 @@ public:
         {
             close(fd_);
         }
+
+        close_notifications();
     }
 
     Ringbuf(Ringbuf&) = delete;
@@ -366,6 +816,23 @@ public:
         this->watermark_ = other.watermark_;
         this->watermark_cb_ = other.watermark_cb_;
         this->watermark_payload_ = other.watermark_payload_;
+        this->read_prefetch_ = other.read_prefetch_;
+        this->write_prefetch_ = other.write_prefetch_;
+        this->data_fd_ = other.data_fd_;
+        this->space_fd_ = other.space_fd_;
+        this->owns_notify_fds_ = other.owns_notify_fds_;
+        this->batches_ = other.batches_;
+        this->batch_open_ = other.batch_open_;
+        this->batch_start_ = other.batch_start_;
+        this->batch_count_ = other.batch_count_;
+        this->batch_size_ = other.batch_size_;
+        this->next_seq_ = other.next_seq_;
+        this->batch_remaining_ = other.batch_remaining_;
+        this->expected_seq_ = other.expected_seq_;
+        this->resume_seq_ = other.resume_seq_;
+        this->batch_end_tail_ = other.batch_end_tail_;
+        this->batch_end_seq_ = other.batch_end_seq_;
+        this->role_ = other.role_;
 
         other.hdr_ = nullptr;
         other.data_ = nullptr;
@@ -374,6 +841,14 @@ public:
         other.watermark_ = 0;
         other.watermark_cb_ = nullptr;
         other.watermark_payload_ = 0;
+        other.read_prefetch_ = 0;
+        other.write_prefetch_ = 0;
+        other.data_fd_ = -1;
+        other.space_fd_ = -1;
+        other.owns_notify_fds_ = false;
+        other.batches_ = false;
+        other.batch_open_ = false;
+        other.role_ = Role::NONE;
     }
 
     Ringbuf& operator=(Ringbuf&& other)
@@ -387,6 +862,23 @@ public:
         this->watermark_ = other.watermark_;
         this->watermark_cb_ = other.watermark_cb_;
         this->watermark_payload_ = other.watermark_payload_;
+        this->read_prefetch_ = other.read_prefetch_;
+        this->write_prefetch_ = other.write_prefetch_;
+        this->data_fd_ = other.data_fd_;
+        this->space_fd_ = other.space_fd_;
+        this->owns_notify_fds_ = other.owns_notify_fds_;
+        this->batches_ = other.batches_;
+        this->batch_open_ = other.batch_open_;
+        this->batch_start_ = other.batch_start_;
+        this->batch_count_ = other.batch_count_;
+        this->batch_size_ = other.batch_size_;
+        this->next_seq_ = other.next_seq_;
+        this->batch_remaining_ = other.batch_remaining_;
+        this->expected_seq_ = other.expected_seq_;
+        this->resume_seq_ = other.resume_seq_;
+        this->batch_end_tail_ = other.batch_end_tail_;
+        this->batch_end_seq_ = other.batch_end_seq_;
+        this->role_ = other.role_;
 
         other.hdr_ = nullptr;
         other.data_ = nullptr;
@@ -395,11 +887,76 @@ public:
         other.watermark_ = 0;
         other.watermark_cb_ = nullptr;
         other.watermark_payload_ = 0;
+        other.read_prefetch_ = 0;
+        other.write_prefetch_ = 0;
+        other.data_fd_ = -1;
+        other.space_fd_ = -1;
+        other.owns_notify_fds_ = false;
+        other.batches_ = false;
+        other.batch_open_ = false;
+        other.role_ = Role::NONE;
         other.owns_fd_ = false;
         return *this;
     }
 
 private:
+    /*
+     * Maps the header and the two views of the data of the ring buffer in fd
+     */
+    static Ringbuf map_ringbuf(int fd)
+    {
+        off_t filesize = lseek(fd, 0, SEEK_END);
+
+        if (filesize == -1)
+        {
+            throw std::runtime_error(
+                fmt::format("Could not get size of underlying file: {},", strerror(errno)));
+        }
+
+        if (lseek(fd, 0, SEEK_CUR) == -1)
+        {
+            throw std::runtime_error(
+                fmt::format("Could not rewind underlying file: {},", strerror(errno)));
+        }
+
+        if (filesize % getpagesize() != 0)
+        {
+            throw std::runtime_error("The file size must be a multiple of the page size!");
+        }
+
+        if (filesize == getpagesize())
+        {
+            throw std::runtime_error(
+                ("The data portion of the ring buffer must be at least one page big!"));
+        }
+
+        Ringbuf rb;
+        rb.fd_ = fd;
+
+        uint64_t data_size = filesize - getpagesize();
+        void* first_mapping =
+            mmap(nullptr, data_size * 2 + getpagesize(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (first_mapping == MAP_FAILED)
+        {
+            throw std::runtime_error(
+                fmt::format("Could not create ringbuffer mapping! {}\n", strerror(errno)));
+        }
+
+        void* second_mapping =
+            mmap(reinterpret_cast<std::byte*>(first_mapping) + getpagesize() + data_size, data_size,
+                 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, getpagesize());
+
+        if (second_mapping == MAP_FAILED)
+        {
+            throw std::runtime_error(
+                fmt::format("Could not create ringbuffer mapping! {}\n", strerror(errno)));
+        }
+        rb.hdr_ = reinterpret_cast<struct ringbuf_header*>(first_mapping);
+        rb.data_ = reinterpret_cast<std::byte*>(rb.hdr_) + getpagesize();
+
+        return rb;
+    }
+
     /*
      * Gets the amount of data that is in the ring buffer
      */
@@ -417,6 +974,280 @@ private:
         }
     }
 
+    /*
+     * Called when a position moves from pos by size bytes. Prefetches the part of the
+     * distance bytes after the new position that was not already ahead of the old one.
+     */
+    void prefetch_ahead(size_t pos, size_t size, size_t distance, bool for_write)
+    {
+        size_t len = std::min(size, distance);
+        // start < hdr_->size and len <= hdr_->size, so this stays within the double mapping
+        size_t start = (pos + size + distance - len) % hdr_->size;
+
+        uintptr_t line = reinterpret_cast<uintptr_t>(data_ + start) & ~(CACHE_LINE_SIZE - 1);
+        uintptr_t end = reinterpret_cast<uintptr_t>(data_ + start + len);
+        for (; line < end; line += CACHE_LINE_SIZE)
+        {
+            prefetch_line(reinterpret_cast<const void*>(line), for_write);
+        }
+    }
+
+    /*
+     * GCC does not count __builtin_prefetch() as a side effect, so it finds prefetch_ahead()
+     * to be "looping pure". With -ffinite-loops, the C++ default from -O2 on, it then drops
+     * calls to it that were not inlined. With GCC 12.2 -O2, the "[prefetch]" test in
+     * tests/test.cpp has no prefetch instruction left, -fno-finite-loops keeps them.
+     * So use inline assembly where we can. prefetchw decodes as a NOP on x86 CPUs that do
+     * not support it, so it is safe to use unconditionally.
+     */
+    static void prefetch_line(const void* addr, bool for_write)
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        if (for_write)
+        {
+            asm volatile("prefetchw %0" : : "m"(*reinterpret_cast<const char*>(addr)));
+        }
+        else
+        {
+            asm volatile("prefetcht0 %0" : : "m"(*reinterpret_cast<const char*>(addr)));
+        }
+#else
+        if (for_write)
+        {
+            __builtin_prefetch(addr, 1, 3);
+        }
+        else
+        {
+            __builtin_prefetch(addr, 0, 3);
+        }
+#endif
+    }
+
+    /*
+     * peek() without the batch mode checks
+     */
+    const std::byte* peek_raw(size_t size)
+    {
+        uint64_t head = hdr_->head.load();
+
+        if (local_tail_ <= head)
+        {
+            if (local_tail_ + size > head)
+            {
+                return nullptr;
+            }
+        }
+        else /* tail > head */
+        {
+            if (local_tail_ + size > head + hdr_->size)
+            {
+                return nullptr;
+            }
+        }
+        return data_ + local_tail_;
+    }
+
+    /*
+     * Resets the writer side to the last published position
+     */
+    void sync_writer()
+    {
+        local_head_ = hdr_->head.load();
+        next_seq_ = std::max(hdr_->head_seq.load(std::memory_order_acquire),
+                             hdr_->tail_seq.load(std::memory_order_acquire));
+        batch_open_ = false;
+    }
+
+    /*
+     * Batch mode: head_seq is stored after head, so it lags behind if the previous writer
+     * died in between. Takes the next sequence number from the last batch header still
+     * in the buffer instead.
+     *
+     * Only safe once the previous writer is gone, as it could otherwise overwrite the
+     * headers consumed meanwhile. If the headers do not add up to the published data,
+     * the sequence number from sync_writer() is kept.
+     */
+    void recover_next_seq()
+    {
+        uint64_t pos = hdr_->tail.load();
+        uint64_t remaining = (local_head_ + hdr_->size - pos) % hdr_->size;
+
+        ringbuf_batch_header batch;
+        uint64_t seq = next_seq_;
+        while (remaining > 0)
+        {
+            if (remaining < sizeof(batch))
+            {
+                return;
+            }
+            memcpy(&batch, data_ + pos, sizeof(batch));
+            if (batch.size > remaining - sizeof(batch))
+            {
+                return;
+            }
+            remaining -= sizeof(batch) + batch.size;
+            pos = (pos + sizeof(batch) + batch.size) % hdr_->size;
+            seq = batch.seq + 1;
+        }
+        next_seq_ = seq;
+    }
+
+    /*
+     * Resets the reader side to the last consumed position
+     */
+    void sync_reader()
+    {
+        local_tail_ = hdr_->tail.load();
+        expected_seq_ = hdr_->tail_seq.load();
+        batch_remaining_ = 0;
+        batch_end_tail_ = local_tail_;
+        batch_end_seq_ = expected_seq_;
+    }
+
+    std::atomic_uint64_t& own_slot()
+    {
+        return role_ == Role::WRITER ? hdr_->writer_owner : hdr_->reader_owner;
+    }
+
+    std::atomic_uint64_t& peer_slot()
+    {
+        return role_ == Role::WRITER ? hdr_->reader_owner : hdr_->writer_owner;
+    }
+
+    void claim(std::atomic_uint64_t& slot, std::atomic_uint64_t& heartbeat, const char* side)
+    {
+        if (role_ != Role::NONE)
+        {
+            throw std::runtime_error(
+                "This endpoint has already claimed a side of the ring buffer!");
+        }
+
+        uint64_t self = owner_id(getpid());
+        uint64_t owner = slot.load();
+        while (true)
+        {
+            if (owner != 0 && owner_alive(owner))
+            {
+                throw std::runtime_error(fmt::format("The {} side of the ring buffer is owned by "
+                                                     "the live process {}!",
+                                                     side, owner & 0xffffffff));
+            }
+            // If this fails, another process claimed the side in between, check it again
+            if (slot.compare_exchange_strong(owner, self))
+            {
+                break;
+            }
+        }
+        heartbeat.store(monotonic_ns());
+    }
+
+    static uint64_t monotonic_ns()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+
+    /*
+     * Reads the start time and state of a process from /proc/<pid>/stat.
+     *
+     * Returns false if the process does not exist or its stat file is not accessible
+     */
+    static bool read_proc_stat(pid_t pid, uint64_t& start_time, char& state)
+    {
+        std::ifstream file(fmt::format("/proc/{}/stat", pid));
+        std::string stat;
+        if (!std::getline(file, stat))
+        {
+            return false;
+        }
+
+        // The command name in parentheses may contain spaces, so parse from the last ')'
+        size_t pos = stat.rfind(')');
+        if (pos == std::string::npos || pos + 2 >= stat.size())
+        {
+            return false;
+        }
+        state = stat[pos + 2];
+
+        // starttime is the 22nd field, the 20th after the command name
+        for (int field = 0; field < 20; field++)
+        {
+            pos = stat.find(' ', pos + 1);
+            if (pos == std::string::npos)
+            {
+                return false;
+            }
+        }
+        start_time = std::strtoull(stat.c_str() + pos + 1, nullptr, 10);
+        return true;
+    }
+
+    /*
+     * Identifies a process by its pid and start time, so that a reused pid is not
+     * mistaken for the original process
+     */
+    static uint64_t owner_id(pid_t pid)
+    {
+        uint64_t start_time = 0;
+        char state;
+        read_proc_stat(pid, start_time, state);
+        return static_cast<uint32_t>(pid) | (start_time << 32);
+    }
+
+    static bool owner_alive(uint64_t owner)
+    {
+        pid_t pid = static_cast<pid_t>(owner & 0xffffffff);
+        uint64_t start_time;
+        char state;
+        if (!read_proc_stat(pid, start_time, state))
+        {
+            // Without access to /proc, we can only check the pid
+            return kill(pid, 0) == 0 || errno == EPERM;
+        }
+        // Zombies have exited already, they are just not reaped yet
+        if (state == 'Z' || state == 'X')
+        {
+            return false;
+        }
+        // The owner could not read its own start time, so there is nothing to compare
+        if ((owner >> 32) == 0)
+        {
+            return true;
+        }
+        return static_cast<uint32_t>(start_time) == (owner >> 32);
+    }
+
+    /*
+     * Wakes up the other endpoint if it announced that it waits on fd.
+     *
+     * The waiting side sets waiting and then checks head/tail, we have updated head/tail
+     * and then check waiting. As all of these are sequentially consistent, at least one
+     * side sees the update of the other.
+     */
+    void notify(std::atomic_uint32_t& waiting, int fd)
+    {
+        if (fd == -1 || waiting.load() == 0 || waiting.exchange(0) == 0)
+        {
+            return;
+        }
+        uint64_t one = 1;
+        // Can only fail if the counter would overflow, in which case it is readable anyways
+        [[maybe_unused]] ssize_t res = ::write(fd, &one, sizeof(one));
+    }
+
+    void close_notifications()
+    {
+        if (owns_notify_fds_)
+        {
+            close(data_fd_);
+            close(space_fd_);
+        }
+        data_fd_ = -1;
+        space_fd_ = -1;
+        owns_notify_fds_ = false;
+    }
+
     Ringbuf() = default;
 
     struct ringbuf_header* hdr_ = nullptr;
@@ -431,5 +1262,36 @@ private:
     uint64_t watermark_ = 0;
     watermark_cb_fn watermark_cb_ = nullptr;
     void* watermark_payload_ = nullptr;
+
+    size_t read_prefetch_ = 0;
+    size_t write_prefetch_ = 0;
+
+    int data_fd_ = -1;
+    int space_fd_ = -1;
+    bool owns_notify_fds_ = false;
+
+    enum class Role
+    {
+        NONE,
+        WRITER,
+        READER,
+    };
+
+    Role role_ = Role::NONE;
+
+    bool batches_ = false;
+    // Writer side of batch mode: the batch that is being reserve()d
+    bool batch_open_ = false;
+    size_t batch_start_ = 0;
+    uint32_t batch_count_ = 0;
+    uint32_t batch_size_ = 0;
+    uint64_t next_seq_ = 0;
+    // Reader side of batch mode: the batch that is being read(), and the end of the last
+    // batch that was read completely, which is how far consume() goes
+    uint64_t batch_remaining_ = 0;
+    uint64_t expected_seq_ = 0;
+    uint64_t resume_seq_ = 0;
+    size_t batch_end_tail_ = 0;
+    uint64_t batch_end_seq_ = 0;
 };
 } // namespace twenty6
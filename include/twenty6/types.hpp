@@ -10,10 +10,38 @@
 #include <atomic>
 #include <cstdint>
 
+// Layout version of ringbuf_header, bumped on every change to it
+constexpr uint64_t RINGBUF_VERSION = 2;
+
 struct ringbuf_header
 {
     uint64_t version;
     uint64_t size;
     std::atomic_uint64_t head;
     std::atomic_uint64_t tail;
+    // Set by an endpoint that is about to block on its notification eventfd
+    std::atomic_uint32_t reader_waiting;
+    std::atomic_uint32_t writer_waiting;
+    uint64_t flags;
+    // Batch mode: sequence number of the next batch to publish, and of the batch at tail
+    std::atomic_uint64_t head_seq;
+    std::atomic_uint64_t tail_seq;
+    // Process owning each side (pid in the lower, start time in the upper 32 bit), or 0
+    std::atomic_uint64_t writer_owner;
+    std::atomic_uint64_t reader_owner;
+    // CLOCK_MONOTONIC time in ns of the last heartbeat of each side
+    std::atomic_uint64_t writer_heartbeat;
+    std::atomic_uint64_t reader_heartbeat;
+};
+
+// Every publish() writes a ringbuf_batch_header in front of the data reserved since
+// the last publish()
+constexpr uint64_t RINGBUF_FLAG_BATCHES = 1;
+
+struct ringbuf_batch_header
+{
+    uint64_t seq;
+    // Number of reserve()s and bytes reserved in this batch, without this header
+    uint32_t count;
+    uint32_t size;
 };
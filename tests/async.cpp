@@ -0,0 +1,149 @@
+// SPDX-License-Identifier: MIT
+//
+// Catch2 test cases for the twenty6 coroutine interface
+//
+// Copyright (C) 2025 Technische Universität Dresden
+// Christian von Elm <christian.von_elm@tu-dresden.de>
+
+#include <catch2/catch_test_macros.hpp>
+#include <cstdint>
+#include <memory>
+#include <poll.h>
+#include <thread>
+#include <twenty6/async.hpp>
+#include <twenty6/ringbuf.hpp>
+#include <unistd.h>
+#include <vector>
+
+twenty6::Task produce(twenty6::EventLoop& loop, twenty6::Ringbuf& rb, uint64_t count)
+{
+    for (uint64_t i = 0; i < count; i++)
+    {
+        std::byte* msg = co_await twenty6::async_reserve(loop, rb, sizeof(uint64_t) * 64);
+        *reinterpret_cast<uint64_t*>(msg) = i;
+        rb.publish();
+    }
+}
+
+twenty6::Task drain(twenty6::EventLoop& loop, twenty6::Ringbuf& rb, uint64_t count, bool& ok)
+{
+    ok = true;
+    for (uint64_t i = 0; i < count; i++)
+    {
+        const std::byte* msg = co_await twenty6::async_read(loop, rb, sizeof(uint64_t) * 64);
+        ok = ok && *reinterpret_cast<const uint64_t*>(msg) == i;
+        rb.consume();
+    }
+}
+
+TEST_CASE("One event loop serves many ring buffers", "[async_many]")
+{
+    // Stays below the default limit of 1024 open files, each ring buffer uses three
+    const size_t ringbufs = 250;
+    // More messages than fit into the buffer, so that both sides have to wait
+    const uint64_t count = getpagesize() / (sizeof(uint64_t) * 64) * 3;
+
+    std::vector<std::unique_ptr<twenty6::Ringbuf>> writers;
+    std::vector<std::unique_ptr<twenty6::Ringbuf>> readers;
+    std::unique_ptr<bool[]> ok(new bool[ringbufs]);
+
+    twenty6::EventLoop loop;
+    for (size_t i = 0; i < ringbufs; i++)
+    {
+        writers.push_back(
+            std::make_unique<twenty6::Ringbuf>(twenty6::Ringbuf::create_memfd_ringbuf(1)));
+        readers.push_back(std::make_unique<twenty6::Ringbuf>(
+            twenty6::Ringbuf::attach_ringbuf(writers.back()->fd())));
+
+        writers.back()->create_notifications();
+        readers.back()->attach_notifications(writers.back()->data_fd(),
+                                             writers.back()->space_fd());
+
+        // Start the readers first, so that they have to park on an empty buffer
+        loop.spawn(drain(loop, *readers.back(), count, ok[i]));
+        loop.spawn(produce(loop, *writers.back(), count));
+    }
+
+    loop.run();
+
+    for (size_t i = 0; i < ringbufs; i++)
+    {
+        REQUIRE(ok[i]);
+    }
+}
+
+TEST_CASE("Event loop wakes up for a writer on another thread", "[async_thread]")
+{
+    std::unique_ptr<twenty6::Ringbuf> writer;
+    REQUIRE_NOTHROW(
+        writer = std::make_unique<twenty6::Ringbuf>(twenty6::Ringbuf::create_memfd_ringbuf(1)));
+    auto reader = twenty6::Ringbuf::attach_ringbuf(writer->fd());
+
+    writer->create_notifications();
+    reader.attach_notifications(writer->data_fd(), writer->space_fd());
+
+    const uint64_t count = 10000;
+    std::thread write_thread([&]() {
+        twenty6::EventLoop loop;
+        loop.spawn(produce(loop, *writer, count));
+        loop.run();
+    });
+
+    bool ok = false;
+    twenty6::EventLoop loop;
+    loop.spawn(drain(loop, reader, count, ok));
+    loop.run();
+    write_thread.join();
+
+    REQUIRE(ok);
+}
+
+TEST_CASE("A completed wait does not make the peer signal again", "[async_cancel_wait]")
+{
+    std::unique_ptr<twenty6::Ringbuf> writer;
+    REQUIRE_NOTHROW(
+        writer = std::make_unique<twenty6::Ringbuf>(twenty6::Ringbuf::create_memfd_ringbuf(1)));
+    auto reader = twenty6::Ringbuf::attach_ringbuf(writer->fd());
+
+    writer->create_notifications();
+    reader.attach_notifications(writer->data_fd(), writer->space_fd());
+
+    // The reader parks on the empty buffer and is woken up by the writer
+    bool ok = false;
+    twenty6::EventLoop loop;
+    loop.spawn(drain(loop, reader, 1, ok));
+    loop.spawn(produce(loop, *writer, 1));
+    loop.run();
+    REQUIRE(ok);
+
+    // Nobody waits anymore, so publishing must not signal the eventfd the loop reset
+    REQUIRE(writer->reserve(8) != nullptr);
+    writer->publish();
+    pollfd pfd = { writer->data_fd(), POLLIN, 0 };
+    REQUIRE(poll(&pfd, 1, 0) == 0);
+}
+
+TEST_CASE("Waiting without notifications throws", "[async_no_notifications]")
+{
+    std::unique_ptr<twenty6::Ringbuf> rb;
+    REQUIRE_NOTHROW(
+        rb = std::make_unique<twenty6::Ringbuf>(twenty6::Ringbuf::create_memfd_ringbuf(1)));
+
+    bool ok = false;
+    twenty6::EventLoop loop;
+    loop.spawn(drain(loop, *rb, 1, ok));
+    REQUIRE_THROWS_AS(loop.run(), std::runtime_error);
+}
+
+TEST_CASE("Waiting for more than the buffer can hold throws", "[async_too_big]")
+{
+    std::unique_ptr<twenty6::Ringbuf> rb;
+    REQUIRE_NOTHROW(
+        rb = std::make_unique<twenty6::Ringbuf>(twenty6::Ringbuf::create_memfd_ringbuf(1)));
+    rb->create_notifications();
+
+    twenty6::EventLoop loop;
+    REQUIRE_THROWS_AS(twenty6::async_read(loop, *rb, rb->size()), std::runtime_error);
+    REQUIRE_THROWS_AS(twenty6::async_reserve(loop, *rb, rb->size()), std::runtime_error);
+    REQUIRE_NOTHROW(twenty6::async_read(loop, *rb, rb->size() - 1));
+}
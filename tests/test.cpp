@@ -6,11 +6,18 @@
 // Christian von Elm <christian.von_elm@tu-drbden.de>
 
 #include <catch2/catch_test_macros.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
 #include <cstdint>
 #include <memory>
+#include <poll.h>
 #include <sys/types.h>
+#include <sys/wait.h>
+#include <thread>
 #include <twenty6/ringbuf.hpp>
 #include <unistd.h>
+#include <vector>
 
 TEST_CASE("Create Ringbuffer", "[create_ringbuffer]")
 {
@@ -24,6 +31,17 @@ TEST_CASE("Ringbuffer creation fails for too big ringbuffers", "[fails_rb_too_bi
                       std::runtime_error);
 };
 
+TEST_CASE("Attaching to an unknown ring buffer version fails", "[attach_version]")
+{
+    auto rb = twenty6::Ringbuf::create_memfd_ringbuf(1);
+    REQUIRE_NOTHROW(twenty6::Ringbuf::attach_ringbuf(rb.fd()));
+
+    uint64_t version = RINGBUF_VERSION - 1;
+    REQUIRE(pwrite(rb.fd(), &version, sizeof(version), offsetof(ringbuf_header, version)) ==
+            sizeof(version));
+    REQUIRE_THROWS_AS(twenty6::Ringbuf::attach_ringbuf(rb.fd()), std::runtime_error);
+};
+
 TEST_CASE("Can reserve memory on the buffer", "[reserve_on_rb]")
 {
     std::unique_ptr<twenty6::Ringbuf> rb;
@@ -159,3 +177,404 @@ TEST_CASE("Can unregister watermark", "[unregister_watermark]")
     rb->publish();
     REQUIRE(called == false);
 }
+
+TEST_CASE("All copy implementations copy correctly", "[copy_impls]")
+{
+    std::vector<uint8_t> src(4096 + 64);
+    std::vector<uint8_t> dst(4096 + 64);
+    for (size_t i = 0; i < src.size(); i++)
+    {
+        src[i] = static_cast<uint8_t>(i * 7 + 3);
+    }
+
+    for (auto impl : { twenty6::CopyImpl::MEMCPY, twenty6::CopyImpl::SSE2,
+                       twenty6::CopyImpl::AVX2, twenty6::CopyImpl::AVX512 })
+    {
+        if (!twenty6::copy_impl_supported(impl))
+        {
+            continue;
+        }
+        for (bool non_temporal : { false, true })
+        {
+            for (size_t size = 0; size <= 4096; size = size < 160 ? size + 1 : size * 2 - 13)
+            {
+                for (size_t offset : { 0, 1, 31 })
+                {
+                    std::fill(dst.begin(), dst.end(), 0);
+                    twenty6::copy(dst.data() + offset, src.data() + 3, size, impl, non_temporal);
+                    REQUIRE(memcmp(dst.data() + offset, src.data() + 3, size) == 0);
+                    REQUIRE(std::all_of(dst.begin(), dst.begin() + offset,
+                                        [](uint8_t b) { return b == 0; }));
+                    REQUIRE(std::all_of(dst.begin() + offset + size, dst.end(),
+                                        [](uint8_t b) { return b == 0; }));
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("write and read_into copy through the buffer", "[write_read_into]")
+{
+    std::unique_ptr<twenty6::Ringbuf> rb;
+
+    REQUIRE_NOTHROW(
+        rb = std::make_unique<twenty6::Ringbuf>(twenty6::Ringbuf::create_memfd_ringbuf(1)));
+
+    std::vector<uint8_t> in(getpagesize() * 0.6);
+    std::vector<uint8_t> out(in.size());
+    for (size_t i = 0; i < in.size(); i++)
+    {
+        in[i] = static_cast<uint8_t>(i);
+    }
+
+    // The second round wraps around the end of the buffer
+    for (bool non_temporal : { false, true })
+    {
+        REQUIRE(rb->write(in.data(), in.size(), non_temporal));
+        REQUIRE_FALSE(rb->write(in.data(), in.size(), non_temporal));
+        rb->publish();
+
+        REQUIRE(rb->read_into(out.data(), out.size()));
+        REQUIRE(in == out);
+        REQUIRE_FALSE(rb->read_into(out.data(), out.size()));
+        rb->consume();
+    }
+}
+
+TEST_CASE("Prefetching does not change the data read", "[prefetch]")
+{
+    std::unique_ptr<twenty6::Ringbuf> rb;
+
+    REQUIRE_NOTHROW(
+        rb = std::make_unique<twenty6::Ringbuf>(twenty6::Ringbuf::create_memfd_ringbuf(2)));
+
+    REQUIRE_THROWS_AS(rb->set_read_prefetch(rb->size() + 1), std::runtime_error);
+    REQUIRE_NOTHROW(rb->set_read_prefetch(rb->size()));
+    REQUIRE_NOTHROW(rb->set_write_prefetch(rb->size()));
+
+    // Wraps around several times, so that the prefetch window crosses the end of the buffer
+    for (uint64_t i = 0; i < rb->size(); i++)
+    {
+        uint64_t* ptr = reinterpret_cast<uint64_t*>(rb->reserve(sizeof(uint64_t) * 3));
+        REQUIRE(ptr != nullptr);
+        ptr[0] = i;
+        rb->publish();
+
+        const uint64_t* read_ptr =
+            reinterpret_cast<const uint64_t*>(rb->read(sizeof(uint64_t) * 3));
+        REQUIRE(read_ptr != nullptr);
+        REQUIRE(read_ptr[0] == i);
+        rb->consume();
+    }
+}
+
+TEST_CASE("Batch mode numbers batches", "[batches]")
+{
+    std::unique_ptr<twenty6::Ringbuf> rb;
+
+    REQUIRE_NOTHROW(rb = std::make_unique<twenty6::Ringbuf>(
+                        twenty6::Ringbuf::create_memfd_ringbuf(1, RINGBUF_FLAG_BATCHES)));
+
+    twenty6::BatchInfo info;
+    REQUIRE_FALSE(rb->next_batch(info));
+
+    for (uint64_t seq = 0; seq < 3; seq++)
+    {
+        for (uint64_t i = 0; i < seq + 1; i++)
+        {
+            *reinterpret_cast<uint64_t*>(rb->reserve(sizeof(uint64_t))) = i;
+        }
+        rb->publish();
+    }
+
+    for (uint64_t seq = 0; seq < 3; seq++)
+    {
+        REQUIRE(rb->next_batch(info));
+        REQUIRE(info.seq == seq);
+        REQUIRE_FALSE(info.has_gap());
+        REQUIRE(info.count == seq + 1);
+        REQUIRE(info.size == (seq + 1) * sizeof(uint64_t));
+
+        for (uint64_t i = 0; i < info.count; i++)
+        {
+            REQUIRE(*reinterpret_cast<const uint64_t*>(rb->read(sizeof(uint64_t))) == i);
+        }
+        REQUIRE_THROWS_AS(rb->read(1), std::runtime_error);
+    }
+    REQUIRE_FALSE(rb->next_batch(info));
+}
+
+TEST_CASE("Batch mode reports gaps", "[batch_gaps]")
+{
+    std::unique_ptr<twenty6::Ringbuf> rb;
+
+    REQUIRE_NOTHROW(rb = std::make_unique<twenty6::Ringbuf>(
+                        twenty6::Ringbuf::create_memfd_ringbuf(1, RINGBUF_FLAG_BATCHES)));
+
+    rb->reserve(8);
+    rb->publish();
+    rb->set_next_seq(5);
+    rb->reserve(8);
+    rb->publish();
+
+    twenty6::BatchInfo info;
+    REQUIRE(rb->next_batch(info));
+    REQUIRE_FALSE(info.has_gap());
+    REQUIRE_THROWS_AS(rb->next_batch(info), std::runtime_error);
+    REQUIRE(rb->read(8) != nullptr);
+
+    REQUIRE(rb->next_batch(info));
+    REQUIRE(info.has_gap());
+    REQUIRE(info.seq == 5);
+    REQUIRE(info.expected_seq == 1);
+}
+
+TEST_CASE("Reattached reader resumes at a batch boundary", "[batch_resume]")
+{
+    std::unique_ptr<twenty6::Ringbuf> writer;
+
+    REQUIRE_NOTHROW(writer = std::make_unique<twenty6::Ringbuf>(
+                        twenty6::Ringbuf::create_memfd_ringbuf(1, RINGBUF_FLAG_BATCHES)));
+
+    for (uint64_t seq = 0; seq < 4; seq++)
+    {
+        *reinterpret_cast<uint64_t*>(writer->reserve(sizeof(uint64_t))) = seq;
+        *reinterpret_cast<uint64_t*>(writer->reserve(sizeof(uint64_t))) = seq;
+        writer->publish();
+    }
+
+    twenty6::BatchInfo info;
+    {
+        auto reader = twenty6::Ringbuf::attach_ringbuf(writer->fd());
+        REQUIRE(reader.next_batch(info));
+        REQUIRE(reader.read(sizeof(uint64_t) * 2) != nullptr);
+        // Only half of this batch is read, so consume() must not release it
+        REQUIRE(reader.next_batch(info));
+        REQUIRE(reader.read(sizeof(uint64_t)) != nullptr);
+        reader.consume();
+    }
+
+    auto reader = twenty6::Ringbuf::attach_ringbuf(writer->fd());
+    REQUIRE(reader.next_batch(info));
+    REQUIRE(info.seq == 1);
+    REQUIRE_FALSE(info.has_gap());
+    REQUIRE(reader.read(sizeof(uint64_t) * 2) != nullptr);
+
+    // The application already processed batch 2 before
+    reader.resume_from(3);
+    REQUIRE(reader.next_batch(info));
+    REQUIRE(info.seq == 3);
+    REQUIRE(*reinterpret_cast<const uint64_t*>(reader.read(sizeof(uint64_t))) == 3);
+
+    // A reattached writer continues the numbering
+    auto writer2 = twenty6::Ringbuf::attach_ringbuf(writer->fd());
+    writer2.reserve(8);
+    writer2.publish();
+    REQUIRE(reader.read(sizeof(uint64_t)) != nullptr);
+    REQUIRE(reader.next_batch(info));
+    REQUIRE(info.seq == 4);
+    REQUIRE_FALSE(info.has_gap());
+}
+
+TEST_CASE("Writer taking over continues the numbering if head_seq lags behind", "[batch_takeover]")
+{
+    auto writer = twenty6::Ringbuf::create_memfd_ringbuf(1, RINGBUF_FLAG_BATCHES);
+    auto reader = twenty6::Ringbuf::attach_ringbuf(writer.fd());
+
+    // A writer that died between storing head and head_seq leaves head_seq behind
+    auto rewind_head_seq = [&]() {
+        uint64_t seq = 0;
+        REQUIRE(pwrite(writer.fd(), &seq, sizeof(seq), offsetof(ringbuf_header, head_seq)) ==
+                sizeof(seq));
+    };
+
+    for (uint64_t seq = 0; seq < 3; seq++)
+    {
+        writer.reserve(8);
+        writer.publish();
+    }
+    rewind_head_seq();
+
+    twenty6::BatchInfo info;
+    {
+        auto writer2 = twenty6::Ringbuf::attach_ringbuf(writer.fd());
+        writer2.claim_writer();
+        writer2.reserve(8);
+        writer2.publish();
+    }
+    for (uint64_t seq = 0; seq < 4; seq++)
+    {
+        REQUIRE(reader.next_batch(info));
+        REQUIRE(info.seq == seq);
+        REQUIRE_FALSE(info.has_gap());
+        REQUIRE(reader.read(8) != nullptr);
+    }
+    reader.consume();
+    rewind_head_seq();
+
+    // Nothing is left in the buffer, so only the reader knows where the numbering stopped
+    auto writer3 = twenty6::Ringbuf::attach_ringbuf(writer.fd());
+    writer3.claim_writer();
+    writer3.reserve(8);
+    writer3.publish();
+    REQUIRE(reader.next_batch(info));
+    REQUIRE(info.seq == 4);
+    REQUIRE_FALSE(info.has_gap());
+}
+
+TEST_CASE("Attaching to a batch mode ring buffer in use returns", "[batch_attach_live]")
+{
+    auto writer = twenty6::Ringbuf::create_memfd_ringbuf(1, RINGBUF_FLAG_BATCHES);
+    auto reader = twenty6::Ringbuf::attach_ringbuf(writer.fd());
+
+    const uint64_t batches = 20000;
+    std::atomic<bool> finished { false };
+
+    std::thread write_thread([&]() {
+        for (uint64_t seq = 0; seq < batches;)
+        {
+            // Varying sizes, so that the headers end up all over the buffer
+            if (writer.reserve(8 + seq % 64) != nullptr)
+            {
+                writer.publish();
+                seq++;
+            }
+        }
+    });
+
+    bool ok = true;
+    std::thread read_thread([&]() {
+        twenty6::BatchInfo info;
+        for (uint64_t seq = 0; seq < batches;)
+        {
+            if (!reader.next_batch(info))
+            {
+                continue;
+            }
+            ok = ok && info.seq == seq && !info.has_gap() && reader.read(info.size) != nullptr;
+            reader.consume();
+            seq++;
+        }
+        finished.store(true);
+    });
+
+    uint64_t attaches = 0;
+    while (!finished.load())
+    {
+        auto observer = twenty6::Ringbuf::attach_ringbuf(writer.fd());
+        attaches++;
+    }
+
+    write_thread.join();
+    read_thread.join();
+    REQUIRE(ok);
+    REQUIRE(attaches > 0);
+}
+
+TEST_CASE("Sides can only be claimed once", "[claim]")
+{
+    std::unique_ptr<twenty6::Ringbuf> writer;
+
+    REQUIRE_NOTHROW(
+        writer = std::make_unique<twenty6::Ringbuf>(twenty6::Ringbuf::create_memfd_ringbuf(1)));
+    auto reader = twenty6::Ringbuf::attach_ringbuf(writer->fd());
+    auto other_reader = twenty6::Ringbuf::attach_ringbuf(writer->fd());
+
+    REQUIRE_THROWS_AS(writer->peer_state(), std::runtime_error);
+
+    writer->claim_writer();
+    REQUIRE(writer->peer_state() == twenty6::PeerState::NONE);
+
+    reader.claim_reader();
+    REQUIRE(writer->peer_state() == twenty6::PeerState::ALIVE);
+    REQUIRE(reader.peer_state() == twenty6::PeerState::ALIVE);
+    REQUIRE_THROWS_AS(other_reader.claim_reader(), std::runtime_error);
+
+    reader.release();
+    REQUIRE(writer->peer_state() == twenty6::PeerState::NONE);
+    REQUIRE_NOTHROW(other_reader.claim_reader());
+}
+
+TEST_CASE("Reader of a dead process can be taken over", "[takeover]")
+{
+    std::unique_ptr<twenty6::Ringbuf> writer;
+
+    REQUIRE_NOTHROW(
+        writer = std::make_unique<twenty6::Ringbuf>(twenty6::Ringbuf::create_memfd_ringbuf(1)));
+    writer->claim_writer();
+
+    for (uint64_t i = 0; i < 2; i++)
+    {
+        *reinterpret_cast<uint64_t*>(writer->reserve(sizeof(uint64_t))) = i;
+    }
+    writer->publish();
+
+    int pipefd[2];
+    REQUIRE(pipe(pipefd) == 0);
+
+    pid_t child = fork();
+    REQUIRE(child != -1);
+    if (child == 0)
+    {
+        // Reads one message and exits without releasing the reader side, like a crash
+        auto reader = twenty6::Ringbuf::attach_ringbuf(writer->fd());
+        reader.claim_reader();
+        reader.read(sizeof(uint64_t));
+        reader.consume();
+        char c;
+        close(pipefd[1]);
+        [[maybe_unused]] ssize_t res = read(pipefd[0], &c, 1);
+        _exit(0);
+    }
+    close(pipefd[0]);
+
+    // Wait until the child has claimed the reader side
+    while (writer->peer_state() != twenty6::PeerState::ALIVE)
+    {
+        usleep(1000);
+    }
+
+    int pidfd = writer->open_peer_pidfd();
+    if (pidfd != -1)
+    {
+        pollfd pfd = { pidfd, POLLIN, 0 };
+        REQUIRE(poll(&pfd, 1, 0) == 0);
+    }
+
+    auto reader = twenty6::Ringbuf::attach_ringbuf(writer->fd());
+    REQUIRE_THROWS_AS(reader.claim_reader(), std::runtime_error);
+
+    close(pipefd[1]);
+    if (pidfd != -1)
+    {
+        pollfd pfd = { pidfd, POLLIN, 0 };
+        REQUIRE(poll(&pfd, 1, 10000) == 1);
+        close(pidfd);
+    }
+    REQUIRE(waitpid(child, nullptr, 0) == child);
+
+    REQUIRE(writer->peer_state() == twenty6::PeerState::DEAD);
+    REQUIRE_NOTHROW(reader.claim_reader());
+    REQUIRE(writer->peer_state() == twenty6::PeerState::ALIVE);
+
+    // The new reader continues after the message the dead one consumed
+    const uint64_t* msg = reinterpret_cast<const uint64_t*>(reader.read(sizeof(uint64_t)));
+    REQUIRE(msg != nullptr);
+    REQUIRE(*msg == 1);
+}
+
+TEST_CASE("Peers without heartbeats become stale", "[heartbeat]")
+{
+    std::unique_ptr<twenty6::Ringbuf> writer;
+
+    REQUIRE_NOTHROW(
+        writer = std::make_unique<twenty6::Ringbuf>(twenty6::Ringbuf::create_memfd_ringbuf(1)));
+    auto reader = twenty6::Ringbuf::attach_ringbuf(writer->fd());
+    writer->claim_writer();
+    reader.claim_reader();
+
+    usleep(20000);
+    REQUIRE(writer->peer_state(10000000) == twenty6::PeerState::STALE);
+    reader.heartbeat();
+    REQUIRE(writer->peer_state(10000000) == twenty6::PeerState::ALIVE);
+}